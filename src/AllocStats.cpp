@@ -0,0 +1,215 @@
+#include "AllocStats.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <sys/resource.h>
+
+#ifdef MINIFILEEXPLORER_ALLOC_STATS
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+// Invocations kept for the mem command
+static constexpr size_t kMaxRecorded = 100;
+
+// Constant-initialised, so allocations made before main() are safe to count
+static atomic<uint64_t> allocationCount{0};
+static atomic<uint64_t> freeCount{0};
+static atomic<uint64_t> bytesAllocated{0};
+static atomic<int64_t> liveBytes{0};
+static atomic<int64_t> peakLiveBytes{0};
+
+#ifdef MINIFILEEXPLORER_ALLOC_STATS
+
+// Blocks are accounted by malloc_usable_size() on both sides, so live bytes
+// balance even for unsized deletes
+static void* countedAlloc(size_t size, size_t alignment) {
+    if (size == 0) {
+        size = 1;
+    }
+    void* p;
+    if (alignment > alignof(max_align_t)) {
+        p = aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    } else {
+        p = malloc(size);
+    }
+    if (!p) {
+        return nullptr;
+    }
+    int64_t usable = static_cast<int64_t>(malloc_usable_size(p));
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    bytesAllocated.fetch_add(static_cast<uint64_t>(usable), memory_order_relaxed);
+    if (AllocAccount* account = boundAllocAccount) {
+        account->allocations.fetch_add(1, memory_order_relaxed);
+        account->bytesAllocated.fetch_add(static_cast<uint64_t>(usable), memory_order_relaxed);
+    }
+    int64_t live = liveBytes.fetch_add(usable, memory_order_relaxed) + usable;
+    int64_t peak = peakLiveBytes.load(memory_order_relaxed);
+    while (live > peak && !peakLiveBytes.compare_exchange_weak(peak, live, memory_order_relaxed)) {
+    }
+    return p;
+}
+
+static void countedFree(void* p) {
+    if (!p) {
+        return;
+    }
+    freeCount.fetch_add(1, memory_order_relaxed);
+    liveBytes.fetch_sub(static_cast<int64_t>(malloc_usable_size(p)), memory_order_relaxed);
+    free(p);
+}
+
+static void* countedAllocOrThrow(size_t size, size_t alignment) {
+    void* p = countedAlloc(size, alignment);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void* operator new(size_t size) { return countedAllocOrThrow(size, 0); }
+void* operator new[](size_t size) { return countedAllocOrThrow(size, 0); }
+void* operator new(size_t size, const nothrow_t&) noexcept { return countedAlloc(size, 0); }
+void* operator new[](size_t size, const nothrow_t&) noexcept { return countedAlloc(size, 0); }
+void* operator new(size_t size, align_val_t a) { return countedAllocOrThrow(size, static_cast<size_t>(a)); }
+void* operator new[](size_t size, align_val_t a) { return countedAllocOrThrow(size, static_cast<size_t>(a)); }
+void* operator new(size_t size, align_val_t a, const nothrow_t&) noexcept {
+    return countedAlloc(size, static_cast<size_t>(a));
+}
+void* operator new[](size_t size, align_val_t a, const nothrow_t&) noexcept {
+    return countedAlloc(size, static_cast<size_t>(a));
+}
+
+void operator delete(void* p) noexcept { countedFree(p); }
+void operator delete[](void* p) noexcept { countedFree(p); }
+void operator delete(void* p, size_t) noexcept { countedFree(p); }
+void operator delete[](void* p, size_t) noexcept { countedFree(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { countedFree(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { countedFree(p); }
+void operator delete(void* p, align_val_t) noexcept { countedFree(p); }
+void operator delete[](void* p, align_val_t) noexcept { countedFree(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { countedFree(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { countedFree(p); }
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept { countedFree(p); }
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept { countedFree(p); }
+
+bool allocStatsEnabled() {
+    return true;
+}
+
+#else
+
+bool allocStatsEnabled() {
+    return false;
+}
+
+#endif
+
+AllocCounters allocCounters() {
+    AllocCounters c;
+    c.allocations = allocationCount.load(memory_order_relaxed);
+    c.frees = freeCount.load(memory_order_relaxed);
+    c.bytesAllocated = bytesAllocated.load(memory_order_relaxed);
+    c.liveBytes = liveBytes.load(memory_order_relaxed);
+    c.peakLiveBytes = peakLiveBytes.load(memory_order_relaxed);
+    return c;
+}
+
+void resetAllocPeak() {
+    peakLiveBytes.store(liveBytes.load(memory_order_relaxed), memory_order_relaxed);
+}
+
+// Writing 5 to clear_refs resets VmHWM to the current RSS (Linux 4.0+);
+// where that fails the reading below is the lifetime peak instead
+static void resetPeakRss() {
+    if (FILE* f = fopen("/proc/self/clear_refs", "w")) {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+static uint64_t peakRss() {
+    if (FILE* f = fopen("/proc/self/status", "r")) {
+        char line[256];
+        unsigned long long kb = 0;
+        bool found = false;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "VmHWM: %llu kB", &kb) == 1) {
+                found = true;
+                break;
+            }
+        }
+        fclose(f);
+        if (found) {
+            return kb * 1024;
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+// The peaks are process-wide, so they are only reset when no other scope
+// is measuring; a scope that overlaps another reports shared peaks
+static atomic<unsigned> activeScopes{0};
+static atomic<uint64_t> scopeSequence{0};
+
+CommandMemoryScope::CommandMemoryScope(const string& command)
+    : command_(command) {
+    startSequence_ = scopeSequence.fetch_add(1) + 1;
+    if (activeScopes.fetch_add(1) == 0) {
+        resetPeakRss();
+        resetAllocPeak();
+    } else {
+        overlapped_ = true;
+    }
+    start_ = allocCounters();
+    startTime_ = chrono::steady_clock::now();
+}
+
+CommandMemoryScope::~CommandMemoryScope() {
+    if (!finished_) {
+        activeScopes.fetch_sub(1);
+    }
+}
+
+CommandMemory CommandMemoryScope::finish() {
+    AllocCounters end = allocCounters();
+    CommandMemory usage;
+    usage.command = command_;
+    usage.allocations = account_.allocations.load(memory_order_relaxed);
+    usage.bytesAllocated = account_.bytesAllocated.load(memory_order_relaxed);
+    usage.peakHeapBytes = end.peakLiveBytes > start_.liveBytes
+        ? static_cast<uint64_t>(end.peakLiveBytes - start_.liveBytes) : 0;
+    usage.peakRssBytes = peakRss();
+    usage.milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - startTime_).count();
+    usage.overlapped = overlapped_ || scopeSequence.load() != startSequence_;
+    if (!finished_) {
+        finished_ = true;
+        activeScopes.fetch_sub(1);
+    }
+    return usage;
+}
+
+static mutex recordMutex;
+static deque<CommandMemory> recorded;
+
+void recordCommandMemory(const CommandMemory& usage) {
+    lock_guard<mutex> lock(recordMutex);
+    recorded.push_back(usage);
+    if (recorded.size() > kMaxRecorded) {
+        recorded.pop_front();
+    }
+}
+
+vector<CommandMemory> recentCommandMemory(size_t count) {
+    lock_guard<mutex> lock(recordMutex);
+    size_t n = min(count, recorded.size());
+    return vector<CommandMemory>(recorded.end() - static_cast<ptrdiff_t>(n), recorded.end());
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Heap accounting through replaced global operator new/delete, compiled in
+// only with -DMINIFILEEXPLORER_ALLOC_STATS=ON. The counters below are
+// process-wide; each allocation is also charged to the AllocAccount bound
+// to the allocating thread, which is how concurrent commands (a background
+// job next to the foreground one) are told apart.
+
+struct AllocCounters {
+    uint64_t allocations{0};
+    uint64_t frees{0};
+    uint64_t bytesAllocated{0};  // Cumulative, usable size of each block
+    int64_t liveBytes{0};
+    int64_t peakLiveBytes{0};    // Since the last resetAllocPeak()
+};
+
+// Allocations made by the threads of one command. parallelFor and the
+// parallel walker carry the binding over to their worker threads.
+struct AllocAccount {
+    atomic<uint64_t> allocations{0};
+    atomic<uint64_t> bytesAllocated{0};
+};
+
+inline thread_local AllocAccount* boundAllocAccount = nullptr;
+
+// Charges this thread's allocations to account while in scope
+class AllocAccountBinding {
+public:
+    explicit AllocAccountBinding(AllocAccount* account) : previous_(boundAllocAccount) {
+        boundAllocAccount = account;
+    }
+    ~AllocAccountBinding() { boundAllocAccount = previous_; }
+
+    AllocAccountBinding(const AllocAccountBinding&) = delete;
+    AllocAccountBinding& operator=(const AllocAccountBinding&) = delete;
+
+private:
+    AllocAccount* previous_;
+};
+
+bool allocStatsEnabled();
+AllocCounters allocCounters();
+// Restart peak tracking from the current live size
+void resetAllocPeak();
+
+// What one command invocation cost
+struct CommandMemory {
+    string command;
+    uint64_t allocations{0};
+    uint64_t bytesAllocated{0};
+    uint64_t peakHeapBytes{0};  // Highest live heap above the starting point
+    uint64_t peakRssBytes{0};   // VmHWM while the command ran
+    double milliseconds{0};
+    // Another command was measured at the same time: the peaks are shared
+    // (allocations are still the command's own)
+    bool overlapped{false};
+};
+
+// Measures from construction to finish() on the constructing thread, which
+// it binds to its own account until destroyed. Used by App::executeLine for
+// foreground commands and on the job thread for background ones.
+class CommandMemoryScope {
+public:
+    explicit CommandMemoryScope(const string& command);
+    ~CommandMemoryScope();
+
+    CommandMemoryScope(const CommandMemoryScope&) = delete;
+    CommandMemoryScope& operator=(const CommandMemoryScope&) = delete;
+
+    CommandMemory finish();
+
+private:
+    string command_;
+    AllocAccount account_;
+    AllocAccountBinding binding_{&account_};
+    AllocCounters start_;
+    uint64_t startSequence_{0};
+    bool overlapped_{false};
+    bool finished_{false};
+    chrono::steady_clock::time_point startTime_;
+};
+
+// The last kept invocations, oldest first (at most count)
+void recordCommandMemory(const CommandMemory& usage);
+vector<CommandMemory> recentCommandMemory(size_t count);
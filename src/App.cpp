@@ -1,19 +1,52 @@
 #include"App.h"
+#include<atomic>
 #include<iostream>
+#include<memory>
+#include<csignal>
+#include<unistd.h>
+#include"AllocStats.h"
 #include"CommandParser.h"
+#include"Completion.h"
+#include"LineEditor.h"
 
 using namespace std;
 
+// Operation that Ctrl-C should cancel; OpControl::cancel() is signal-safe
+static atomic<OpControl*> foregroundOp{nullptr};
+
+static void onInterrupt(int){
+    OpControl* op=foregroundOp.load();
+    if(op){
+        op->cancel();
+    }
+}
+
 App::App(FileSystemContext& ctx, const CommandRegistry& registry)
     :ctx_(ctx),registry_(registry){}
 
 void App::printPrompt() const {
+    if(ctx_.jobs){
+        ctx_.jobs->reportFinished(cout);
+    }
     cout<<"Current Directory: "<<ctx_.currentDir<<endl;
-    cout<<"Enter command (type 'help' for all commands): ";
+}
+
+// Strip a trailing '&' ("du / &" or "du /&"); returns true if there was one
+static bool takeBackgroundSuffix(ParsedCommand& parsed){
+    string& last=parsed.args.empty()?parsed.name:parsed.args.back();
+    if(last.empty()||last.back()!='&'){
+        return false;
+    }
+    last.pop_back();
+    if(last.empty()&&!parsed.args.empty()){
+        parsed.args.pop_back();
+    }
+    return true;
 }
 
 void App::executeLine(const string& line) const{
     ParsedCommand parsed=CommandParser::parse(line);
+    bool background=takeBackgroundSuffix(parsed);
 
     if(parsed.name.empty()){
         return;
@@ -21,21 +54,98 @@ void App::executeLine(const string& line) const{
 
     const Command* cmd= registry_.find(parsed.name);
     if(!cmd){
-        cout<<"Unknown command: "<<parsed.name<<endl;
+        *ctx_.out<<"Unknown command: "<<parsed.name<<endl;
+        return;
+    }
+
+    if(background){
+        launchBackground(*cmd,parsed);
+        return;
+    }
+
+    OpControl* op=ctx_.op.get();
+    if(op){
+        op->begin(parsed.name);
+    }
+
+    // Heap and RSS cost of the command, for 'mem' (instrumented builds only)
+    unique_ptr<CommandMemoryScope> memory;
+    if(allocStatsEnabled()){
+        memory=make_unique<CommandMemoryScope>(line);
+    }
+
+    try{
+        cmd->handler(parsed.args,ctx_);
+    }catch(const OperationCancelled&){
+        if(op) op->end();
+        if(memory) recordCommandMemory(memory->finish());
+        *ctx_.out<<"Interrupted: "<<parsed.name<<endl;
         return;
     }
 
-    cmd->handler(parsed.args,ctx_);
+    if(op) op->end();
+    if(memory) recordCommandMemory(memory->finish());
+}
+
+void App::launchBackground(const Command& cmd,const ParsedCommand& parsed) const{
+    if(!ctx_.jobs){
+        *ctx_.out<<"Background jobs are not available here"<<endl;
+        return;
+    }
 
+    string commandLine=parsed.name;
+    for(const auto& arg:parsed.args){
+        commandLine+=" "+arg;
+    }
+
+    vector<string> args=parsed.args;
+    int id=ctx_.jobs->launch(commandLine,ctx_,
+        [&cmd,args,commandLine](FileSystemContext& jobCtx){
+            // Measured on the job thread, so 'mem' lists the job on its own
+            unique_ptr<CommandMemoryScope> memory;
+            if(allocStatsEnabled()){
+                memory=make_unique<CommandMemoryScope>(commandLine+" &");
+            }
+            try{
+                cmd.handler(args,jobCtx);
+            }catch(...){
+                if(memory) recordCommandMemory(memory->finish());
+                throw;
+            }
+            if(memory) recordCommandMemory(memory->finish());
+        });
+    *ctx_.out<<"["<<id<<"] "<<commandLine<<endl;
 }
 
 void App::run(){
+    // Ctrl-C cancels the running command instead of killing the session
+    struct sigaction sa{};
+    sa.sa_handler=onInterrupt;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags=SA_RESTART;
+    sigaction(SIGINT,&sa,nullptr);
+
+    if(ctx_.op){
+        ctx_.op->setProgressEnabled(isatty(STDERR_FILENO));
+        foregroundOp.store(ctx_.op.get());
+    }
+
+    // Tab completes command names and paths; the completer keeps the
+    // sorted names of recently completed directories between keystrokes
+    Completer completer(registry_,ctx_.homeDir);
+    LineEditor editor;
+    editor.setCompleter([&](const string& line,size_t cursor){
+        return completer.complete(line,cursor,ctx_.currentDir);
+    });
+
     string line;
     while(ctx_.running){
         printPrompt();
-        if(!getline(cin,line)){
+        if(!editor.readLine("Enter command (type 'help' for all commands): ",line)){
             break;
         }
         executeLine(line);
     }
+
+    foregroundOp.store(nullptr);
 }
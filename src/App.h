@@ -2,15 +2,18 @@
 
 #include<string>
 #include"Command.h"
+#include"CommandParser.h"
 #include"FileSystemContext.h"
 
 class App{
 public:
     App(FileSystemContext& ctx,const CommandRegistry& registry);
     void run();
+    // Run one command line, printing to ctx.out (also used by the daemon)
+    void executeLine(const std::string& line) const;
 private:
     FileSystemContext& ctx_;
     const CommandRegistry& registry_;
     void printPrompt() const;
-    void executeLine(const std::string& line) const;
+    void launchBackground(const Command& cmd,const ParsedCommand& parsed) const;
 };
@@ -1,10 +1,20 @@
 #include "Commands.h"
+#include "AllocStats.h"
+#include "ExternalSort.h"
+#include "FileView.h"
 #include "FsUtil.h"
+#include "Pack.h"
+#include "Parallel.h"
+#include "Sync.h"
+#include "TreeStats.h"
+#include "Watch.h"
 
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
 #include <ctime>
+#include <pwd.h>
+#include <thread>
 
 using namespace std;
 namespace fs = filesystem;
@@ -13,8 +23,10 @@ namespace fs = filesystem;
 static string formatTime(time_t t) {
     if (t == 0) return "-";
     char buf[64];
-    struct tm* tm_info = localtime(&t);
-    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tm_info);
+    // localtime()'s static buffer is shared with daemon sessions and jobs
+    struct tm tm_info;
+    localtime_r(&t, &tm_info);
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm_info);
     return string(buf);
 }
 
@@ -29,16 +41,139 @@ static string formatSizeAuto(uintmax_t bytes) {
     }
 }
 
+// User name for a uid, or the number if it has no passwd entry
+static string ownerName(uint32_t uid) {
+    struct passwd pw;
+    struct passwd* result = nullptr;
+    char buf[1024];
+    if (getpwuid_r(uid, &pw, buf, sizeof(buf), &result) == 0 && result) {
+        return result->pw_name;
+    }
+    return to_string(uid);
+}
+
+// Resolve a user-typed path, through the session's path cache when present
+static fs::path resolvePath(const FileSystemContext& ctx, const string& input) {
+    if (ctx.pathCache) {
+        return ctx.pathCache->resolve(ctx.currentDir, input, ctx.homeDir);
+    }
+    return fsutil::normalizePath(ctx.currentDir, input, ctx.homeDir);
+}
+
+// For the paths rm, rmdir and mv act on: bypasses the path cache, whose
+// entries may be a few seconds old and still follow a symlink that has
+// since been retargeted
+static fs::path resolvePathFresh(const FileSystemContext& ctx, const string& input) {
+    return fsutil::normalizePath(ctx.currentDir, input, ctx.homeDir);
+}
+
+// Every command that creates, removes or renames something calls this so
+// cached path resolutions cannot point at the old layout
+static void treeChanged(const FileSystemContext& ctx) {
+    if (ctx.pathCache) {
+        ctx.pathCache->invalidate();
+    }
+}
+
+// rm -r: pre-walk for a summary, confirm once, then bulk delete
+static void removeTreeCommand(const fs::path& dirPath, const string& name,
+                              FileSystemContext& ctx) {
+    ostream& out = *ctx.out;
+
+    // Deleting the directory we are in (or one above it) leaves the
+    // session pointing at nothing
+    fs::path rel = ctx.currentDir.lexically_relative(dirPath);
+    if (!rel.empty() && *rel.begin() != "..") {
+        out << "Refusing to delete the current directory or its parent: " << name << "\n";
+        return;
+    }
+
+    fsutil::RemovalPlan plan = fsutil::planTreeRemoval(dirPath, ctx.op.get());
+
+    out << "About to delete " << name << ": " << plan.fileCount << " files, "
+        << plan.dirCount << " directories, " << formatSizeAuto(plan.totalBytes) << "\n";
+    out << "Are you sure? (y/n) ";
+    string response;
+    getline(*ctx.in, response);
+    if (response != "y" && response != "Y") {
+        out << "Deletion cancelled.\n";
+        return;
+    }
+
+    fsutil::RemovalResult result =
+        fsutil::removeTree(plan, defaultWorkerCount(), ctx.op.get());
+    treeChanged(ctx);
+
+    out << "Deleted " << result.filesRemoved << " files and "
+        << result.dirsRemoved << " directories\n";
+    if (result.errorCount > 0) {
+        out << result.errorCount << " errors:\n";
+        for (const auto& err : result.errors) {
+            out << "  " << err << "\n";
+        }
+        if (result.errorCount > result.errors.size()) {
+            out << "  ... (" << (result.errorCount - result.errors.size()) << " more)\n";
+        }
+    }
+}
+
+// Longest line head/tail print in full; view cuts lines much shorter
+static constexpr size_t kMaxPrintedLine = 64 * 1024;
+static constexpr size_t kMaxViewLine = 400;
+
+// Print up to count lines of a file starting at pos and stopping before
+// end; returns the offset after the last line printed. For the pager,
+// lines are numbered (or marked with their byte offset where the line index
+// does not reach yet) and control characters are masked.
+static uint64_t printFileLines(ostream& out, FileView& view, uint64_t pos, uint64_t count,
+                               uint64_t end, bool pager) {
+    string line;
+    uint64_t number = pager ? view.knownLineNumber(pos) : FileView::kNoLine;
+    for (uint64_t i = 0; i < count && pos < end; ++i) {
+        bool cut = false;
+        uint64_t next = view.readLine(pos, line, pager ? kMaxViewLine : kMaxPrintedLine, &cut);
+        if (pager) {
+            for (char& c : line) {
+                unsigned char u = static_cast<unsigned char>(c);
+                if ((u < 0x20 && c != '\t') || u == 0x7f) c = '.';
+            }
+            if (number != FileView::kNoLine) {
+                out << setw(10) << (number + 1 + i) << "  ";
+            } else {
+                out << setw(10) << ("@" + to_string(pos)) << "  ";
+            }
+        }
+        out << line << (cut ? " [...]" : "") << "\n";
+        pos = next;
+    }
+    return pos;
+}
+
+// "-n N" option shared by head, tail and view; false on a bad number
+static bool parseLineCount(const vector<string>& args, size_t& i, uint64_t& count) {
+    if (i + 1 >= args.size()) {
+        return false;
+    }
+    try {
+        count = stoull(args[++i]);
+    } catch (const exception&) {
+        return false;
+    }
+    return true;
+}
+
 void registerBuiltInCommands(CommandRegistry& registry) {
 
     // ==================== help ====================
     registry.registerCommand(
         "help",
         "Show all available commands.",
-        [&registry](const vector<string>& /*args*/, FileSystemContext& /*ctx*/) {
-            cout << "Available commands:\n";
+        [&registry](const vector<string>& /*args*/, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            out << "Available commands:\n";
             for (const auto& cmd : registry.all()) {
-                cout << "  " << cmd.name << ": " << cmd.description << "\n";
+                out << "  " << cmd.name << ": " << cmd.description << "\n";
             }
         }
     );
@@ -48,16 +183,117 @@ void registerBuiltInCommands(CommandRegistry& registry) {
         "exit",
         "Exit MiniFileExplorer.",
         [](const vector<string>& /*args*/, FileSystemContext& ctx) {
-            cout << "MiniFileExplorer closed successfully\n";
+            ostream& out = *ctx.out;
+
+            out << "MiniFileExplorer closed successfully\n";
             ctx.running = false;
         }
     );
 
+    // ==================== jobs ====================
+    registry.registerCommand(
+        "jobs",
+        "List background jobs (start one by ending a command with '&').",
+        [](const vector<string>& /*args*/, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            if (!ctx.jobs) {
+                out << "Job control is not available here\n";
+                return;
+            }
+
+            vector<JobSummary> jobs = ctx.jobs->list();
+            if (jobs.empty()) {
+                out << "No background jobs\n";
+                return;
+            }
+            for (const auto& job : jobs) {
+                out << "[" << job.id << "] " << left << setw(9) << jobStateName(job.state)
+                    << job.commandLine << "\n";
+            }
+        }
+    );
+
+    // ==================== fg ====================
+    registry.registerCommand(
+        "fg",
+        "Show a background job's output and wait for it. Usage: fg [N]",
+        [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            if (!ctx.jobs) {
+                out << "Job control is not available here\n";
+                return;
+            }
+
+            int id = 0;
+            if (args.empty()) {
+                // Like a shell, default to the most recent job
+                vector<JobSummary> jobs = ctx.jobs->list();
+                if (jobs.empty()) {
+                    out << "No background jobs\n";
+                    return;
+                }
+                id = jobs.back().id;
+            } else {
+                try {
+                    id = stoi(args[0]);
+                } catch (const exception&) {
+                    out << "Invalid job number: " << args[0] << "\n";
+                    return;
+                }
+            }
+
+            // Ctrl-C while waiting kills the job, as in a shell
+            OpControl* op = ctx.op.get();
+            bool found = ctx.jobs->foreground(id, out, [op] {
+                return op && op->cancelled();
+            });
+            if (!found) {
+                out << "No such job: " << id << "\n";
+            }
+        }
+    );
+
+    // ==================== kill ====================
+    registry.registerCommand(
+        "kill",
+        "Cancel a background job. Usage: kill [N]",
+        [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            if (!ctx.jobs) {
+                out << "Job control is not available here\n";
+                return;
+            }
+            if (args.empty()) {
+                out << "Missing job number: Please enter 'kill [N]'\n";
+                return;
+            }
+
+            int id = 0;
+            try {
+                id = stoi(args[0]);
+            } catch (const exception&) {
+                out << "Invalid job number: " << args[0] << "\n";
+                return;
+            }
+
+            if (!ctx.jobs->kill(id)) {
+                out << "No running job: " << id << "\n";
+                return;
+            }
+            out << "Cancelling job " << id << "\n";
+        }
+    );
+
     // ==================== cd ====================
     registry.registerCommand(
         "cd",
         "Switch to target directory. Usage: cd [path]",
         [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
             fs::path targetPath;
 
             if (args.empty()) {
@@ -65,22 +301,27 @@ void registerBuiltInCommands(CommandRegistry& registry) {
                 targetPath = ctx.homeDir;
             } else {
                 // Normalize the path (handles ~, relative paths, etc.)
-                targetPath = fsutil::normalizePath(ctx.currentDir, args[0]);
+                targetPath = resolvePath(ctx, args[0]);
             }
 
             // Check if path exists
             if (!fs::exists(targetPath)) {
-                cout << "Invalid directory: " << targetPath << "\n";
+                out << "Invalid directory: " << targetPath << "\n";
                 return;
             }
 
             // Check if it's a directory (not a file)
             if (!fs::is_directory(targetPath)) {
-                cout << "Not a directory: " << targetPath << "\n";
+                out << "Not a directory: " << targetPath << "\n";
                 return;
             }
 
             ctx.currentDir = targetPath;
+
+            // The next command is almost always ls/search: warm the cache now
+            if (ctx.prefetchOnCd && ctx.dirCache) {
+                ctx.dirCache->prefetch(ctx.currentDir, ctx.prefetchReadAhead);
+            }
         }
     );
 
@@ -89,12 +330,7 @@ void registerBuiltInCommands(CommandRegistry& registry) {
         "ls",
         "List all files and directories. Usage: ls [-s|-t]",
         [](const vector<string>& args, FileSystemContext& ctx) {
-            vector<FileInfo> entries = fsutil::listDirectory(ctx.currentDir);
-
-            if (entries.empty()) {
-                cout << "(empty directory)\n";
-                return;
-            }
+            ostream& out = *ctx.out;
 
             // Check for sorting options
             bool sortBySize = false;
@@ -105,38 +341,15 @@ void registerBuiltInCommands(CommandRegistry& registry) {
                 if (arg == "-t") sortByTime = true;
             }
 
-            // Sort if requested
-            if (sortBySize) {
-                // Sort by size descending (need to calculate dir sizes)
-                for (auto& entry : entries) {
-                    if (entry.isDirectory) {
-                        entry.size = fsutil::calcDirectorySize(entry.path);
-                    }
-                }
-                sort(entries.begin(), entries.end(),
-                     [](const FileInfo& a, const FileInfo& b) {
-                         // Empty folders at the end
-                         if (a.size == 0 && b.size != 0) return false;
-                         if (a.size != 0 && b.size == 0) return true;
-                         return a.size > b.size;
-                     });
-            } else if (sortByTime) {
-                // Sort by modification time descending
-                sort(entries.begin(), entries.end(),
-                     [](const FileInfo& a, const FileInfo& b) {
-                         return a.mtime > b.mtime;
-                     });
-            }
-
-            // Print header
-            cout << left << setw(30) << "Name"
-                 << setw(8) << "Type"
-                 << setw(15) << "Size(B)"
-                 << "Modify Time" << "\n";
-            cout << string(75, '-') << "\n";
-
-            // Print entries
-            for (const auto& entry : entries) {
+            auto printHeader = [&]() {
+                out << left << setw(30) << "Name"
+                     << setw(8) << "Type"
+                     << setw(15) << "Size(B)"
+                     << "Modify Time" << "\n";
+                out << string(75, '-') << "\n";
+            };
+
+            auto printEntry = [&](const FileInfo& entry) {
                 string displayName = entry.name;
                 if (entry.isDirectory) {
                     displayName += "/";
@@ -156,10 +369,231 @@ void registerBuiltInCommands(CommandRegistry& registry) {
                     sizeStr = to_string(entry.size);
                 }
 
-                cout << left << setw(30) << displayName
+                out << left << setw(30) << displayName
                      << setw(8) << typeStr
                      << setw(15) << sizeStr
                      << formatTime(entry.mtime) << "\n";
+            };
+
+            if (!sortBySize && !sortByTime) {
+                vector<FileInfo> entries;
+                try {
+                    entries = ctx.dirCache
+                        ? ctx.dirCache->list(ctx.currentDir)
+                        : fsutil::listDirectory(ctx.currentDir);
+                } catch (const OperationCancelled&) {
+                    throw;
+                } catch (const exception& e) {
+                    out << "Error listing directory: " << e.what() << "\n";
+                    return;
+                }
+
+                if (entries.empty()) {
+                    out << "(empty directory)\n";
+                    return;
+                }
+
+                printHeader();
+                for (const auto& entry : entries) {
+                    printEntry(entry);
+                }
+                return;
+            }
+
+            // Sorted listings stream through the external sorter, so a
+            // directory of tens of millions of entries never has to fit in
+            // memory (see 'set sortmem')
+            ExternalSorter sorter(ctx.sortMemory, ctx.sortTempDir, ctx.op.get());
+            bool fromDuTree = false;
+            try {
+                fsutil::listDirectory(ctx.currentDir, ctx.op.get(), [&](const FileInfo& info) {
+                    if (!sortBySize) {
+                        // Sort by modification time descending
+                        sorter.add(sortKeyNewestFirst(info.mtime), info);
+                        return;
+                    }
+                    // Sort by size descending (need to calculate dir sizes);
+                    // a tree kept by 'du --keep' saves walking them again.
+                    // Empty entries get the largest key and so end up last.
+                    FileInfo entry = info;
+                    if (entry.isDirectory) {
+                        const DuNode* node = ctx.duTree ? ctx.duTree->find(entry.path) : nullptr;
+                        if (node) {
+                            entry.size = node->apparent;
+                            fromDuTree = true;
+                        } else {
+                            entry.size = fsutil::calcDirectorySize(entry.path, ctx.op.get());
+                        }
+                    }
+                    sorter.add(sortKeyDescending(entry.size), entry);
+                });
+            } catch (const OperationCancelled&) {
+                throw;
+            } catch (const exception& e) {
+                out << "Error listing directory: " << e.what() << "\n";
+                return;
+            }
+
+            if (sorter.count() == 0) {
+                out << "(empty directory)\n";
+                return;
+            }
+            if (fromDuTree) {
+                out << "Directory sizes from du --keep of " << ctx.duTree->rootPath().string()
+                    << " at " << formatTime(ctx.duTree->builtAt()) << "\n";
+            }
+
+            printHeader();
+            sorter.finish(printEntry);
+        }
+    );
+
+    // ==================== set ====================
+    registry.registerCommand(
+        "set",
+        "Show or change session settings. "
+        "Usage: set [prefetch on|off] [readahead N] [sortmem MB] [sorttmp DIR]",
+        [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            if (args.empty()) {
+                out << "prefetch  " << (ctx.prefetchOnCd ? "on" : "off") << "\n";
+                out << "readahead " << ctx.prefetchReadAhead << "\n";
+                out << "sortmem   " << ctx.sortMemory / (1024 * 1024) << "\n";
+                out << "sorttmp   " << ctx.sortTempDir.string() << "\n";
+                return;
+            }
+
+            if (args.size() < 2) {
+                out << "Usage: set [name] [value]\n";
+                return;
+            }
+
+            const string& name = args[0];
+            const string& value = args[1];
+
+            if (name == "prefetch") {
+                if (value != "on" && value != "off") {
+                    out << "Invalid value for prefetch: " << value << " (use on|off)\n";
+                    return;
+                }
+                ctx.prefetchOnCd = (value == "on");
+            } else if (name == "readahead") {
+                try {
+                    ctx.prefetchReadAhead = stoul(value);
+                } catch (const exception&) {
+                    out << "Invalid value for readahead: " << value << "\n";
+                    return;
+                }
+            } else if (name == "sortmem") {
+                size_t megabytes = 0;
+                try {
+                    megabytes = stoul(value);
+                } catch (const exception&) {
+                }
+                if (megabytes == 0) {
+                    out << "Invalid value for sortmem: " << value << " (megabytes, at least 1)\n";
+                    return;
+                }
+                ctx.sortMemory = megabytes * 1024 * 1024;
+            } else if (name == "sorttmp") {
+                fs::path dir = resolvePath(ctx, value);
+                if (!fs::is_directory(dir)) {
+                    out << "Not a directory: " << value << "\n";
+                    return;
+                }
+                ctx.sortTempDir = dir;
+            } else {
+                out << "Unknown setting: " << name << "\n";
+                return;
+            }
+
+            out << name << " = " << value << "\n";
+        }
+    );
+
+    // ==================== mem ====================
+    registry.registerCommand(
+        "mem",
+        "Show heap allocations and peak memory of the last commands "
+        "(instrumented builds). Usage: mem [count]",
+        [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            if (!allocStatsEnabled()) {
+                out << "Allocation statistics are not compiled in "
+                       "(configure with -DMINIFILEEXPLORER_ALLOC_STATS=ON)\n";
+                return;
+            }
+
+            size_t count = 10;
+            if (!args.empty()) {
+                try {
+                    count = stoul(args[0]);
+                } catch (const exception&) {
+                    out << "Usage: mem [count]\n";
+                    return;
+                }
+            }
+
+            vector<CommandMemory> recent = recentCommandMemory(count);
+            if (recent.empty()) {
+                out << "No commands recorded yet\n";
+                return;
+            }
+
+            out << left << setw(32) << "Command" << right << setw(12) << "Allocs"
+                << setw(12) << "Allocated" << setw(12) << "Peak heap"
+                << setw(12) << "Peak RSS" << setw(10) << "Time" << "\n";
+            out << string(90, '-') << "\n";
+            bool anyOverlapped = false;
+            for (const auto& usage : recent) {
+                string command = usage.command.size() > 29
+                    ? usage.command.substr(0, 26) + "..." : usage.command;
+                if (usage.overlapped) {
+                    command += "*";
+                    anyOverlapped = true;
+                }
+                out << left << setw(32) << command << right
+                    << setw(12) << usage.allocations
+                    << setw(12) << formatSizeAuto(usage.bytesAllocated)
+                    << setw(12) << formatSizeAuto(usage.peakHeapBytes)
+                    << setw(12) << formatSizeAuto(usage.peakRssBytes)
+                    << setw(7) << static_cast<uint64_t>(usage.milliseconds) << " ms\n";
+            }
+
+            if (anyOverlapped) {
+                out << "* ran alongside another command: peaks are shared, allocations are its own\n";
+            }
+            AllocCounters now = allocCounters();
+            out << "Live heap: " << formatSizeAuto(static_cast<uintmax_t>(max<int64_t>(0, now.liveBytes)))
+                << " in " << (now.allocations - now.frees) << " blocks\n";
+        }
+    );
+
+    // ==================== cachestats ====================
+    registry.registerCommand(
+        "cachestats",
+        "Show hit rates of the session caches.",
+        [](const vector<string>& /*args*/, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            auto line = [&out](const string& name, uint64_t hits, uint64_t misses) {
+                uint64_t total = hits + misses;
+                out << left << setw(20) << name << hits << " hits, " << misses << " misses";
+                if (total > 0) {
+                    out << " (" << (hits * 100 / total) << "% hit rate)";
+                }
+                out << "\n";
+            };
+
+            if (ctx.dirCache) {
+                line("Directory listings", ctx.dirCache->hits(), ctx.dirCache->misses());
+            }
+            if (ctx.pathCache) {
+                PathCache::Stats stats = ctx.pathCache->stats();
+                line("Path resolutions", stats.hits, stats.misses);
+                line("Path components", stats.dentryHits, stats.dentryMisses);
             }
         }
     );
@@ -169,24 +603,27 @@ void registerBuiltInCommands(CommandRegistry& registry) {
         "touch",
         "Create an empty file. Usage: touch [filename]",
         [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
             if (args.empty()) {
-                cout << "Missing filename: Please enter 'touch [filename]'\n";
+                out << "Missing filename: Please enter 'touch [filename]'\n";
                 return;
             }
 
-            fs::path filePath = fsutil::normalizePath(ctx.currentDir, args[0]);
+            fs::path filePath = resolvePath(ctx, args[0]);
 
             // Check if file already exists
             if (fs::exists(filePath)) {
-                cout << "File already exists: " << args[0] << "\n";
+                out << "File already exists: " << args[0] << "\n";
                 return;
             }
 
             try {
                 fsutil::createFile(filePath);
-                cout << "Created file: " << args[0] << "\n";
+                treeChanged(ctx);
+                out << "Created file: " << args[0] << "\n";
             } catch (const exception& e) {
-                cout << "Error creating file: " << e.what() << "\n";
+                out << "Error creating file: " << e.what() << "\n";
             }
         }
     );
@@ -196,24 +633,27 @@ void registerBuiltInCommands(CommandRegistry& registry) {
         "mkdir",
         "Create a new directory. Usage: mkdir [foldername]",
         [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
             if (args.empty()) {
-                cout << "Missing folder name: Please enter 'mkdir [foldername]'\n";
+                out << "Missing folder name: Please enter 'mkdir [foldername]'\n";
                 return;
             }
 
-            fs::path dirPath = fsutil::normalizePath(ctx.currentDir, args[0]);
+            fs::path dirPath = resolvePath(ctx, args[0]);
 
             // Check if directory already exists
             if (fs::exists(dirPath)) {
-                cout << "Directory already exists: " << args[0] << "\n";
+                out << "Directory already exists: " << args[0] << "\n";
                 return;
             }
 
             try {
                 fsutil::createDir(dirPath);
-                cout << "Created directory: " << args[0] << "\n";
+                treeChanged(ctx);
+                out << "Created directory: " << args[0] << "\n";
             } catch (const exception& e) {
-                cout << "Error creating directory: " << e.what() << "\n";
+                out << "Error creating directory: " << e.what() << "\n";
             }
         }
     );
@@ -221,41 +661,57 @@ void registerBuiltInCommands(CommandRegistry& registry) {
     // ==================== rm ====================
     registry.registerCommand(
         "rm",
-        "Delete a file. Usage: rm [filename]",
+        "Delete a file, or a whole directory tree with -r. Usage: rm [-r] [name]",
         [](const vector<string>& args, FileSystemContext& ctx) {
-            if (args.empty()) {
-                cout << "Missing filename: Please enter 'rm [filename]'\n";
+            ostream& out = *ctx.out;
+
+            bool recursive = false;
+            string target;
+            for (const auto& arg : args) {
+                if (arg == "-r" || arg == "-R") {
+                    recursive = true;
+                } else if (target.empty()) {
+                    target = arg;
+                }
+            }
+
+            if (target.empty()) {
+                out << "Missing filename: Please enter 'rm [-r] [filename]'\n";
                 return;
             }
 
-            fs::path filePath = fsutil::normalizePath(ctx.currentDir, args[0]);
+            fs::path filePath = resolvePathFresh(ctx, target);
 
             // Check if file exists
             if (!fs::exists(filePath)) {
-                cout << "File not found: " << args[0] << "\n";
+                out << "File not found: " << target << "\n";
                 return;
             }
 
-            // Check if it's a file (not a directory)
             if (fs::is_directory(filePath)) {
-                cout << "Not a file (use rmdir for directories): " << args[0] << "\n";
+                if (!recursive) {
+                    out << "Not a file (use rmdir or rm -r for directories): " << target << "\n";
+                    return;
+                }
+                removeTreeCommand(filePath, target, ctx);
                 return;
             }
 
             // Confirmation prompt
-            cout << "Are you sure to delete " << args[0] << "? (y/n) ";
+            out << "Are you sure to delete " << target << "? (y/n) ";
             string response;
-            getline(cin, response);
+            getline(*ctx.in, response);
 
             if (response == "y" || response == "Y") {
                 try {
                     fsutil::removeFile(filePath);
-                    cout << "Deleted: " << args[0] << "\n";
+                    treeChanged(ctx);
+                    out << "Deleted: " << target << "\n";
                 } catch (const exception& e) {
-                    cout << "Error deleting file: " << e.what() << "\n";
+                    out << "Error deleting file: " << e.what() << "\n";
                 }
             } else {
-                cout << "Deletion cancelled.\n";
+                out << "Deletion cancelled.\n";
             }
         }
     );
@@ -265,32 +721,35 @@ void registerBuiltInCommands(CommandRegistry& registry) {
         "rmdir",
         "Delete an empty directory. Usage: rmdir [foldername]",
         [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
             if (args.empty()) {
-                cout << "Missing folder name: Please enter 'rmdir [foldername]'\n";
+                out << "Missing folder name: Please enter 'rmdir [foldername]'\n";
                 return;
             }
 
-            fs::path dirPath = fsutil::normalizePath(ctx.currentDir, args[0]);
+            fs::path dirPath = resolvePathFresh(ctx, args[0]);
 
             // Check if directory exists
             if (!fs::exists(dirPath)) {
-                cout << "Directory not found: " << args[0] << "\n";
+                out << "Directory not found: " << args[0] << "\n";
                 return;
             }
 
             // Check if it's a directory
             if (!fs::is_directory(dirPath)) {
-                cout << "Not a directory: " << args[0] << "\n";
+                out << "Not a directory: " << args[0] << "\n";
                 return;
             }
 
             // Try to remove (will fail if not empty)
             if (!fsutil::removeEmptyDir(dirPath)) {
-                cout << "Directory not empty: " << args[0] << "\n";
+                out << "Directory not empty: " << args[0] << "\n";
                 return;
             }
+            treeChanged(ctx);
 
-            cout << "Deleted directory: " << args[0] << "\n";
+            out << "Deleted directory: " << args[0] << "\n";
         }
     );
 
@@ -299,29 +758,31 @@ void registerBuiltInCommands(CommandRegistry& registry) {
         "stat",
         "Show file/directory info. Usage: stat [name]",
         [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
             if (args.empty()) {
-                cout << "Missing target: Please enter 'stat [name]'\n";
+                out << "Missing target: Please enter 'stat [name]'\n";
                 return;
             }
 
-            fs::path targetPath = fsutil::normalizePath(ctx.currentDir, args[0]);
+            fs::path targetPath = resolvePath(ctx, args[0]);
 
             // Check if target exists
             if (!fs::exists(targetPath)) {
-                cout << "Target not found: " << args[0] << "\n";
+                out << "Target not found: " << args[0] << "\n";
                 return;
             }
 
-            FileInfo info = fsutil::getFileInfo(targetPath, true);
+            FileInfo info = fsutil::getFileInfo(targetPath, true, ctx.op.get());
 
-            cout << "Information for: " << args[0] << "\n";
-            cout << string(40, '-') << "\n";
-            cout << "Type:              " << (info.isDirectory ? "Directory" : "File") << "\n";
-            cout << "Path:              " << info.path << "\n";
-            cout << "Size:              " << (info.isDirectory ? "-" : to_string(info.size) + " bytes") << "\n";
-            cout << "Creation Time:     " << formatTime(info.ctime) << "\n";
-            cout << "Modification Time: " << formatTime(info.mtime) << "\n";
-            cout << "Access Time:       " << formatTime(info.atime) << "\n";
+            out << "Information for: " << args[0] << "\n";
+            out << string(40, '-') << "\n";
+            out << "Type:              " << (info.isDirectory ? "Directory" : "File") << "\n";
+            out << "Path:              " << info.path << "\n";
+            out << "Size:              " << (info.isDirectory ? "-" : to_string(info.size) + " bytes") << "\n";
+            out << "Creation Time:     " << formatTime(info.ctime) << "\n";
+            out << "Modification Time: " << formatTime(info.mtime) << "\n";
+            out << "Access Time:       " << formatTime(info.atime) << "\n";
         }
     );
 
@@ -330,23 +791,423 @@ void registerBuiltInCommands(CommandRegistry& registry) {
         "search",
         "Search files/folders by keyword (recursive, case-insensitive). Usage: search [keyword]",
         [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
             if (args.empty()) {
-                cout << "Missing keyword: Please enter 'search [keyword]'\n";
+                out << "Missing keyword: Please enter 'search [keyword]'\n";
                 return;
             }
 
             const string& keyword = args[0];
-            vector<FileInfo> results = fsutil::searchRecursive(ctx.currentDir, keyword);
+            // Results are sorted by path; the sorter spills to disk past
+            // the memory budget instead of collecting them all
+            ExternalSorter sorter(ctx.sortMemory, ctx.sortTempDir, ctx.op.get());
+            fsutil::searchRecursive(ctx.currentDir, keyword, ctx.op.get(),
+                                    [&](const FileInfo& info) {
+                                        sorter.add(info.path.native(), info);
+                                    });
+
+            if (sorter.count() == 0) {
+                out << "No results found for '" << keyword << "'\n";
+                return;
+            }
+
+            out << "Search results for '" << keyword << "' (" << sorter.count() << " items):\n";
+            sorter.finish([&](const FileInfo& result) {
+                string typeStr = result.isDirectory ? "(Dir)" : "(File)";
+                out << result.path.string() << " " << typeStr << "\n";
+            });
+        }
+    );
+
+    // ==================== find ====================
+    registry.registerCommand(
+        "find",
+        "Find entries matching an expression (-name, -iname, -path, -type, -size, "
+        "-mtime, -atime, -mindepth, -maxdepth, -prune, !, -o). The start directory "
+        "is tested too; -path patterns see paths beginning with dir as typed ('.' by "
+        "default), results are printed as absolute paths. "
+        "Usage: find [dir] [expression]",
+        [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            // Like find(1): a leading non-option argument is the start directory
+            fs::path startPath = ctx.currentDir;
+            string shownStart = ".";  // What -path sees the start directory as
+            vector<string> exprTokens = args;
+            if (!args.empty() && args[0][0] != '-' && args[0] != "!" && args[0] != "(") {
+                startPath = resolvePath(ctx, args[0]);
+                shownStart = args[0];
+                exprTokens.erase(exprTokens.begin());
+            }
+
+            if (!fs::is_directory(startPath)) {
+                out << "Not a directory: " << startPath << "\n";
+                return;
+            }
+
+            FindQuery query;
+            try {
+                query = FindQuery::parse(exprTokens);
+            } catch (const runtime_error& e) {
+                out << "Invalid expression: " << e.what() << "\n";
+                return;
+            }
+
+            vector<FileInfo> results = fsutil::findRecursive(startPath, query, ctx.op.get(), shownStart);
 
             if (results.empty()) {
-                cout << "No results found for '" << keyword << "'\n";
+                out << "No matches\n";
                 return;
             }
 
-            cout << "Search results for '" << keyword << "' (" << results.size() << " items):\n";
+            out << "Found " << results.size() << " items:\n";
             for (const auto& result : results) {
                 string typeStr = result.isDirectory ? "(Dir)" : "(File)";
-                cout << result.path.string() << " " << typeStr << "\n";
+                out << result.path.string() << " " << typeStr << "\n";
+            }
+        }
+    );
+
+    // ==================== stats ====================
+    registry.registerCommand(
+        "stats",
+        "Summarise a tree by extension, size, age and owner in one pass. "
+        "Usage: stats [dir] [-n top]",
+        [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            size_t topN = 10;
+            string target;
+            for (size_t i = 0; i < args.size(); ++i) {
+                if (args[i] == "-n" && i + 1 < args.size()) {
+                    try {
+                        topN = stoul(args[++i]);
+                    } catch (const exception&) {
+                        out << "Invalid number for -n: " << args[i] << "\n";
+                        return;
+                    }
+                } else if (target.empty()) {
+                    target = args[i];
+                }
+            }
+
+            fs::path dirPath = target.empty() ? ctx.currentDir : resolvePath(ctx, target);
+            if (!fs::is_directory(dirPath)) {
+                out << "Not a directory: " << dirPath << "\n";
+                return;
+            }
+
+            TreeStats stats = collectTreeStats(dirPath, ctx.op.get());
+
+            out << "Statistics for " << dirPath.string() << ":\n";
+            out << "  " << stats.files.count << " files (" << formatSizeAuto(stats.files.bytes)
+                << "), " << stats.dirs << " directories, " << stats.others << " other entries\n";
+
+            auto row = [&out](const string& label, const StatBucket& bucket) {
+                out << "  " << left << setw(18) << label << setw(12) << bucket.count
+                    << formatSizeAuto(bucket.bytes) << "\n";
+            };
+            auto header = [&out](const string& title) {
+                out << "\n" << title << "\n";
+                out << "  " << left << setw(18) << "" << setw(12) << "Files" << "Size\n";
+            };
+
+            // Keyed tables: the topN rows by bytes
+            auto topRows = [&](const auto& table, auto labelOf) {
+                using Item = pair<string, StatBucket>;
+                vector<Item> items;
+                for (const auto& [key, bucket] : table) {
+                    items.emplace_back(labelOf(key), bucket);
+                }
+                size_t n = min(topN, items.size());
+                partial_sort(items.begin(), items.begin() + n, items.end(),
+                             [](const Item& a, const Item& b) { return a.second.bytes > b.second.bytes; });
+                for (size_t i = 0; i < n; ++i) {
+                    row(items[i].first, items[i].second);
+                }
+            };
+
+            header("By extension (top " + to_string(topN) + "):");
+            topRows(stats.byExtension, [](const string& ext) { return ext; });
+
+            header("By size:");
+            for (size_t k = 0; k < stats.bySizeLog2.size(); ++k) {
+                if (stats.bySizeLog2[k].count == 0) continue;
+                string label = k == 0 ? "empty" : "< " + formatSizeAuto(uintmax_t(1) << min<size_t>(k, 63));
+                row(label, stats.bySizeLog2[k]);
+            }
+
+            header("By age (modified):");
+            for (int a = 0; a < AgeBucketCount; ++a) {
+                if (stats.byAge[a].count == 0) continue;
+                row(ageBucketName(a), stats.byAge[a]);
+            }
+
+            header("By owner (top " + to_string(topN) + "):");
+            topRows(stats.byOwner, [](uint32_t uid) {
+                return uid == UINT32_MAX ? string("(other)") : ownerName(uid);
+            });
+        }
+    );
+
+    // ==================== watch ====================
+    registry.registerCommand(
+        "watch",
+        "Stream changes in a directory until Ctrl-C (-r: whole subtree, "
+        "-w: coalescing window in ms). Usage: watch [dir] [-r] [-w ms]",
+        [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            bool recursive = false;
+            long windowMs = 200;
+            string target;
+            for (size_t i = 0; i < args.size(); ++i) {
+                if (args[i] == "-r") {
+                    recursive = true;
+                } else if (args[i] == "-w" && i + 1 < args.size()) {
+                    try {
+                        windowMs = stol(args[++i]);
+                    } catch (const exception&) {
+                        out << "Invalid window: " << args[i] << "\n";
+                        return;
+                    }
+                } else if (target.empty()) {
+                    target = args[i];
+                }
+            }
+
+            fs::path dirPath = target.empty() ? ctx.currentDir : resolvePath(ctx, target);
+            if (!fs::is_directory(dirPath)) {
+                out << "Not a directory: " << dirPath << "\n";
+                return;
+            }
+
+            DirWatcher watcher(dirPath, recursive);
+            try {
+                watcher.start(ctx.op.get());
+            } catch (const runtime_error& e) {
+                out << "Cannot watch " << dirPath << ": " << e.what() << "\n";
+                return;
+            }
+
+            out << "Watching " << dirPath.string() << " (" << watcher.watchCount()
+                << " directories";
+            if (watcher.failedWatches() > 0) {
+                out << ", " << watcher.failedWatches() << " could not be watched";
+            }
+            out << "). Press Ctrl-C to stop.\n" << flush;
+
+            WatchCoalescer coalescer{chrono::milliseconds(max(0L, windowMs))};
+            OpControl* op = ctx.op.get();
+            WatchEvent event;
+            uint64_t reportedDrops = 0;
+
+            while (!(op && op->cancelled())) {
+                bool any = false;
+                auto now = WatchCoalescer::Clock::now();
+                while (watcher.pop(event)) {
+                    coalescer.add(event, now);
+                    any = true;
+                }
+
+                vector<string> lines = coalescer.flush(now, false);
+                if (!lines.empty()) {
+                    string stamp = formatTime(time(nullptr)).substr(11);
+                    for (const auto& line : lines) {
+                        out << stamp << "  " << line << "\n";
+                    }
+                    out << flush;
+                }
+
+                uint64_t drops = watcher.droppedEvents();
+                if (drops != reportedDrops) {
+                    out << "Warning: events lost (queue overflow)\n" << flush;
+                    reportedDrops = drops;
+                }
+
+                if (!any) {
+                    this_thread::sleep_for(chrono::milliseconds(20));
+                }
+            }
+
+            for (const auto& line : coalescer.flush(WatchCoalescer::Clock::now(), true)) {
+                out << formatTime(time(nullptr)).substr(11) << "  " << line << "\n";
+            }
+            watcher.stop();
+            out << "Stopped watching " << dirPath.string() << "\n";
+        }
+    );
+
+    // ==================== head ====================
+    registry.registerCommand(
+        "head",
+        "Show the first lines of a file (default 10). Usage: head [-n lines] [file]",
+        [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            uint64_t count = 10;
+            string target;
+            for (size_t i = 0; i < args.size(); ++i) {
+                if (args[i] == "-n") {
+                    if (!parseLineCount(args, i, count)) {
+                        out << "Invalid line count\n";
+                        return;
+                    }
+                } else {
+                    target = args[i];
+                }
+            }
+            if (target.empty()) {
+                out << "Usage: head [-n lines] [file]\n";
+                return;
+            }
+
+            try {
+                FileView view(resolvePath(ctx, target));
+                printFileLines(out, view, 0, count, view.size(), false);
+            } catch (const exception& e) {
+                out << "Cannot read " << target << ": " << e.what() << "\n";
+            }
+        }
+    );
+
+    // ==================== tail ====================
+    registry.registerCommand(
+        "tail",
+        "Show the last lines of a file (default 10); -f keeps printing lines "
+        "as they are appended until Ctrl-C. Usage: tail [-n lines] [-f] [file]",
+        [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            uint64_t count = 10;
+            bool follow = false;
+            string target;
+            for (size_t i = 0; i < args.size(); ++i) {
+                if (args[i] == "-n") {
+                    if (!parseLineCount(args, i, count)) {
+                        out << "Invalid line count\n";
+                        return;
+                    }
+                } else if (args[i] == "-f") {
+                    follow = true;
+                } else {
+                    target = args[i];
+                }
+            }
+            if (target.empty()) {
+                out << "Usage: tail [-n lines] [-f] [file]\n";
+                return;
+            }
+
+            try {
+                // A followed log may be truncated under us: no mapping then
+                FileView view(resolvePath(ctx, target), !follow);
+                uint64_t pos = printFileLines(out, view, view.linesBefore(view.size(), count),
+                                              count, view.size(), false);
+                out << flush;
+
+                OpControl* op = ctx.op.get();
+                while (follow && !(op && op->cancelled())) {
+                    switch (view.refresh()) {
+                        case FileView::Change::None:
+                            this_thread::sleep_for(chrono::milliseconds(100));
+                            continue;
+                        case FileView::Change::Grew:
+                            break;
+                        case FileView::Change::Truncated:
+                            out << "tail: " << target << ": file truncated\n";
+                            pos = 0;
+                            break;
+                        case FileView::Change::Replaced:
+                            out << "tail: " << target << ": file replaced, following the new file\n";
+                            pos = 0;
+                            break;
+                    }
+                    // Complete lines only; a partial last line waits for its newline
+                    uint64_t end = view.lineStartAt(view.size());
+                    pos = printFileLines(out, view, pos, UINT64_MAX, end, false);
+                    out << flush;
+                }
+            } catch (const exception& e) {
+                out << "Cannot read " << target << ": " << e.what() << "\n";
+            }
+        }
+    );
+
+    // ==================== view ====================
+    registry.registerCommand(
+        "view",
+        "Page through a file of any size, starting at a line, a byte offset "
+        "(@N) or the end ($). Usage: view [-n lines] [file] [line|@offset|$]",
+        [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            uint64_t pageLines = 30;
+            vector<string> rest;
+            for (size_t i = 0; i < args.size(); ++i) {
+                if (args[i] == "-n") {
+                    if (!parseLineCount(args, i, pageLines) || pageLines == 0) {
+                        out << "Invalid line count\n";
+                        return;
+                    }
+                } else {
+                    rest.push_back(args[i]);
+                }
+            }
+            if (rest.empty() || rest.size() > 2) {
+                out << "Usage: view [-n lines] [file] [line|@offset|$]\n";
+                return;
+            }
+
+            try {
+                FileView view(resolvePath(ctx, rest[0]));
+
+                // Line numbers are 1-based for the user; false on bad input
+                auto jump = [&](const string& where, uint64_t& top) {
+                    try {
+                        if (where == "$") {
+                            top = view.linesBefore(view.size(), pageLines);
+                        } else if (!where.empty() && where[0] == '@') {
+                            top = view.lineStartAt(stoull(where.substr(1)));
+                        } else {
+                            uint64_t line = stoull(where);
+                            top = view.lineOffset(line > 0 ? line - 1 : 0);
+                        }
+                    } catch (const exception&) {
+                        return false;
+                    }
+                    return true;
+                };
+
+                uint64_t top = 0;
+                if (rest.size() == 2 && !jump(rest[1], top)) {
+                    out << "Invalid position: " << rest[1] << "\n";
+                    return;
+                }
+
+                for (;;) {
+                    uint64_t next = printFileLines(out, view, top, pageLines, view.size(), true);
+                    uint64_t percent = view.size() > 0 ? next * 100 / view.size() : 100;
+                    out << "-- " << rest[0] << ": bytes " << top << "-" << next << " of "
+                        << view.size() << " (" << percent << "%) -- "
+                        << "Enter: next, b: back, N: line, @N: offset, $: end, q: quit ";
+
+                    string response;
+                    if (!getline(*ctx.in, response) || response == "q") {
+                        out << "\n";
+                        break;
+                    }
+                    if (response.empty()) {
+                        if (next < view.size()) top = next;
+                    } else if (response == "b") {
+                        top = view.linesBefore(top, pageLines);
+                    } else if (!jump(response, top)) {
+                        out << "Invalid position: " << response << "\n";
+                    }
+                }
+            } catch (const exception& e) {
+                out << "Cannot read " << rest[0] << ": " << e.what() << "\n";
             }
         }
     );
@@ -356,17 +1217,19 @@ void registerBuiltInCommands(CommandRegistry& registry) {
         "cp",
         "Copy file. Usage: cp [source] [target]",
         [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
             if (args.size() < 2) {
-                cout << "Usage: cp [source file path] [target path]\n";
+                out << "Usage: cp [source file path] [target path]\n";
                 return;
             }
 
-            fs::path srcPath = fsutil::normalizePath(ctx.currentDir, args[0]);
-            fs::path dstPath = fsutil::normalizePath(ctx.currentDir, args[1]);
+            fs::path srcPath = resolvePath(ctx, args[0]);
+            fs::path dstPath = resolvePath(ctx, args[1]);
 
             // Check if source exists
             if (!fs::exists(srcPath)) {
-                cout << "Source not found: " << args[0] << "\n";
+                out << "Source not found: " << args[0] << "\n";
                 return;
             }
 
@@ -379,11 +1242,11 @@ void registerBuiltInCommands(CommandRegistry& registry) {
             // Check if target file exists
             bool overwrite = false;
             if (fs::exists(targetFile)) {
-                cout << "File exists in target: Overwrite? (y/n) ";
+                out << "File exists in target: Overwrite? (y/n) ";
                 string response;
-                getline(cin, response);
+                getline(*ctx.in, response);
                 if (response != "y" && response != "Y") {
-                    cout << "Copy cancelled.\n";
+                    out << "Copy cancelled.\n";
                     return;
                 }
                 overwrite = true;
@@ -391,9 +1254,10 @@ void registerBuiltInCommands(CommandRegistry& registry) {
 
             try {
                 fsutil::copyFile(srcPath, dstPath, overwrite);
-                cout << "Copied: " << args[0] << " -> " << targetFile << "\n";
+                treeChanged(ctx);
+                out << "Copied: " << args[0] << " -> " << targetFile << "\n";
             } catch (const exception& e) {
-                cout << "Error copying: " << e.what() << "\n";
+                out << "Error copying: " << e.what() << "\n";
             }
         }
     );
@@ -403,17 +1267,19 @@ void registerBuiltInCommands(CommandRegistry& registry) {
         "mv",
         "Move/rename file or folder. Usage: mv [source] [target]",
         [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
             if (args.size() < 2) {
-                cout << "Usage: mv [source path] [target path]\n";
+                out << "Usage: mv [source path] [target path]\n";
                 return;
             }
 
-            fs::path srcPath = fsutil::normalizePath(ctx.currentDir, args[0]);
-            fs::path dstPath = fsutil::normalizePath(ctx.currentDir, args[1]);
+            fs::path srcPath = resolvePathFresh(ctx, args[0]);
+            fs::path dstPath = resolvePathFresh(ctx, args[1]);
 
             // Check if source exists
             if (!fs::exists(srcPath)) {
-                cout << "Source not found: " << args[0] << "\n";
+                out << "Source not found: " << args[0] << "\n";
                 return;
             }
 
@@ -426,11 +1292,11 @@ void registerBuiltInCommands(CommandRegistry& registry) {
             // Check if target exists
             bool overwrite = false;
             if (fs::exists(targetPath)) {
-                cout << "Target exists: Overwrite? (y/n) ";
+                out << "Target exists: Overwrite? (y/n) ";
                 string response;
-                getline(cin, response);
+                getline(*ctx.in, response);
                 if (response != "y" && response != "Y") {
-                    cout << "Move cancelled.\n";
+                    out << "Move cancelled.\n";
                     return;
                 }
                 overwrite = true;
@@ -438,15 +1304,260 @@ void registerBuiltInCommands(CommandRegistry& registry) {
 
             // Check if target directory exists
             if (!fs::exists(dstPath.parent_path()) && !fs::is_directory(dstPath)) {
-                cout << "Invalid target path: " << args[1] << "\n";
+                out << "Invalid target path: " << args[1] << "\n";
                 return;
             }
 
             try {
                 fsutil::movePath(srcPath, dstPath, overwrite);
-                cout << "Moved: " << args[0] << " -> " << targetPath << "\n";
+                treeChanged(ctx);
+                out << "Moved: " << args[0] << " -> " << targetPath << "\n";
             } catch (const exception& e) {
-                cout << "Error moving: " << e.what() << "\n";
+                out << "Error moving: " << e.what() << "\n";
+            }
+        }
+    );
+
+    // ==================== sync ====================
+    registry.registerCommand(
+        "sync",
+        "Mirror a folder into another, rewriting only what changed "
+        "(-n: dry run). Usage: sync [-n] [source] [target]",
+        [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            SyncOptions options;
+            vector<string> paths;
+            for (const auto& arg : args) {
+                if (arg == "-n") {
+                    options.dryRun = true;
+                } else {
+                    paths.push_back(arg);
+                }
+            }
+
+            if (paths.size() != 2) {
+                out << "Usage: sync [-n] [source folder] [target folder]\n";
+                return;
+            }
+
+            fs::path srcPath = resolvePath(ctx, paths[0]);
+            fs::path dstPath = resolvePath(ctx, paths[1]);
+
+            if (!fs::is_directory(srcPath)) {
+                out << "Not a directory: " << paths[0] << "\n";
+                return;
+            }
+            if (fs::exists(dstPath) && !fs::is_directory(dstPath)) {
+                out << "Target is not a directory: " << paths[1] << "\n";
+                return;
+            }
+            // A target inside the source would be synced into itself (and a
+            // source inside the target would be overwritten while it is read)
+            error_code ec;
+            fs::path srcReal = fs::weakly_canonical(srcPath, ec);
+            fs::path dstReal = fs::weakly_canonical(dstPath, ec);
+            if (srcReal.empty() || dstReal.empty()) {
+                srcReal = srcPath;
+                dstReal = dstPath;
+            }
+            if (srcReal == dstReal) {
+                out << "Source and target are the same folder\n";
+                return;
+            }
+            fs::path dstRel = dstReal.lexically_relative(srcReal);
+            fs::path srcRel = srcReal.lexically_relative(dstReal);
+            if ((!dstRel.empty() && *dstRel.begin() != "..") ||
+                (!srcRel.empty() && *srcRel.begin() != "..")) {
+                out << "Source and target must not contain each other\n";
+                return;
+            }
+
+            SyncStats stats;
+            try {
+                stats = syncTrees(srcPath, dstPath, options, ctx.op.get());
+            } catch (const OperationCancelled&) {
+                throw;
+            } catch (const exception& e) {
+                out << "Error syncing: " << e.what() << "\n";
+                return;
+            }
+            if (!options.dryRun) {
+                treeChanged(ctx);
+            }
+
+            out << (options.dryRun ? "Would sync " : "Synced ") << paths[0] << " -> " << paths[1] << "\n";
+            out << "  Files: " << stats.filesScanned << " scanned, "
+                << stats.filesUnchanged << " unchanged, "
+                << stats.filesCopied << " copied, "
+                << stats.filesPatched << " patched\n";
+            if (stats.dirsCreated > 0) {
+                out << "  Directories created: " << stats.dirsCreated << "\n";
+            }
+            if (!options.dryRun) {
+                out << "  Copied: " << formatSizeAuto(stats.bytesCopied)
+                    << ", patched: " << formatSizeAuto(stats.bytesWritten) << " written, "
+                    << formatSizeAuto(stats.bytesReused) << " reused\n";
+            }
+            if (stats.errorCount > 0) {
+                out << "  Errors: " << stats.errorCount << "\n";
+                for (const auto& message : stats.errors) {
+                    out << "    " << message << "\n";
+                }
+            }
+        }
+    );
+
+    // ==================== pack ====================
+    registry.registerCommand(
+        "pack",
+        "Pack a folder's contents into a compressed, seekable archive. "
+        "Usage: pack [folder] [archive]",
+        [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            if (args.size() != 2) {
+                out << "Usage: pack [folder] [archive file]\n";
+                return;
+            }
+
+            fs::path dirPath = resolvePath(ctx, args[0]);
+            fs::path archivePath = resolvePath(ctx, args[1]);
+
+            if (!fs::is_directory(dirPath)) {
+                out << "Not a directory: " << args[0] << "\n";
+                return;
+            }
+            if (fs::is_directory(archivePath)) {
+                out << "Target is a directory: " << args[1] << "\n";
+                return;
+            }
+            if (fs::exists(archivePath)) {
+                out << "File exists in target: Overwrite? (y/n) ";
+                string response;
+                getline(*ctx.in, response);
+                if (response != "y" && response != "Y") {
+                    out << "Pack cancelled.\n";
+                    return;
+                }
+            }
+
+            PackStats stats;
+            try {
+                stats = packTree(dirPath, archivePath, PackOptions{}, ctx.op.get());
+            } catch (const OperationCancelled&) {
+                throw;
+            } catch (const exception& e) {
+                out << "Error packing: " << e.what() << "\n";
+                return;
+            }
+            treeChanged(ctx);
+
+            out << "Packed " << args[0] << " -> " << args[1] << "\n";
+            out << "  " << stats.files << " files, " << stats.dirs << " directories, "
+                << stats.symlinks << " symlinks\n";
+            out << "  " << formatSizeAuto(stats.rawBytes) << " in " << stats.chunks << " chunks -> "
+                << formatSizeAuto(stats.archiveBytes);
+            if (stats.rawBytes > 0) {
+                out << " (" << (stats.archiveBytes * 100 / stats.rawBytes) << "%)";
+            }
+            out << "\n";
+            if (stats.errorCount > 0) {
+                out << "  Errors: " << stats.errorCount << "\n";
+                for (const auto& message : stats.errors) {
+                    out << "    " << message << "\n";
+                }
+            }
+        }
+    );
+
+    // ==================== unpack ====================
+    registry.registerCommand(
+        "unpack",
+        "Extract an archive made by pack, or only the given paths from it "
+        "(-l: list contents, -p: keep setuid/setgid/sticky bits). "
+        "Usage: unpack [-l] [-p] [archive] [folder] [path...]",
+        [](const vector<string>& args, FileSystemContext& ctx) {
+            ostream& out = *ctx.out;
+
+            bool listOnly = false;
+            bool preserveSpecialBits = false;
+            vector<string> rest;
+            for (const auto& arg : args) {
+                if (arg == "-l") {
+                    listOnly = true;
+                } else if (arg == "-p") {
+                    preserveSpecialBits = true;
+                } else {
+                    rest.push_back(arg);
+                }
+            }
+
+            if (rest.empty() || (!listOnly && rest.size() < 2)) {
+                out << "Usage: unpack [-l] [-p] [archive file] [target folder] [path in archive...]\n";
+                return;
+            }
+
+            try {
+                PackReader reader(resolvePath(ctx, rest[0]));
+
+                if (listOnly) {
+                    vector<string> filters(rest.begin() + 1, rest.end());
+                    for (size_t i : reader.select(filters)) {
+                        const PackEntry& e = reader.entries()[i];
+                        string type = e.kind == PackEntry::Dir     ? "Dir"
+                                    : e.kind == PackEntry::Symlink ? "Link"
+                                                                   : "File";
+                        out << left << setw(6) << type << right << setw(12)
+                            << (e.kind == PackEntry::File ? to_string(e.size) : "-") << "  "
+                            << formatTime(static_cast<time_t>(e.mtimeNs / 1000000000)) << "  "
+                            << e.path;
+                        if (e.kind == PackEntry::Symlink) {
+                            out << " -> " << e.target;
+                        }
+                        out << "\n";
+                    }
+                    return;
+                }
+
+                fs::path dirPath = resolvePath(ctx, rest[1]);
+                if (fs::exists(dirPath) && !fs::is_directory(dirPath)) {
+                    out << "Target is not a directory: " << rest[1] << "\n";
+                    return;
+                }
+
+                vector<string> filters(rest.begin() + 2, rest.end());
+                vector<size_t> selection = reader.select(filters);
+                vector<string> existing = reader.conflicts(selection, dirPath);
+                if (!existing.empty()) {
+                    out << existing.size() << " file(s) exist in target (" << existing.front()
+                        << (existing.size() > 1 ? ", ..." : "") << "): Overwrite? (y/n) ";
+                    string response;
+                    getline(*ctx.in, response);
+                    if (response != "y" && response != "Y") {
+                        out << "Unpack cancelled.\n";
+                        return;
+                    }
+                }
+
+                UnpackStats stats = reader.extract(selection, dirPath, ctx.op.get(), preserveSpecialBits);
+                treeChanged(ctx);
+
+                out << "Unpacked " << rest[0] << " -> " << rest[1] << "\n";
+                out << "  " << stats.files << " files, " << stats.dirs << " directories, "
+                    << stats.symlinks << " symlinks\n";
+                out << "  " << formatSizeAuto(stats.bytesWritten) << " written from "
+                    << stats.chunksRead << " chunks\n";
+                if (stats.errorCount > 0) {
+                    out << "  Errors: " << stats.errorCount << "\n";
+                    for (const auto& message : stats.errors) {
+                        out << "    " << message << "\n";
+                    }
+                }
+            } catch (const OperationCancelled&) {
+                throw;
+            } catch (const exception& e) {
+                out << "Error unpacking: " << e.what() << "\n";
             }
         }
     );
@@ -454,29 +1565,88 @@ void registerBuiltInCommands(CommandRegistry& registry) {
     // ==================== du ====================
     registry.registerCommand(
         "du",
-        "Calculate directory size. Usage: du [foldername]",
+        "Calculate directory size (apparent and on disk). "
+        "Usage: du [-x] [-d depth] [-n top] [--keep] [foldername]",
         [](const vector<string>& args, FileSystemContext& ctx) {
-            if (args.empty()) {
-                cout << "Missing folder name: Please enter 'du [foldername]'\n";
+            ostream& out = *ctx.out;
+
+            bool oneFileSystem = false;
+            bool keepTree = false;
+            size_t maxDepth = 0;
+            size_t topN = 10;
+            string target;
+            for (size_t i = 0; i < args.size(); ++i) {
+                const string& arg = args[i];
+                if (arg == "-x") {
+                    oneFileSystem = true;
+                } else if (arg == "--keep") {
+                    keepTree = true;
+                } else if ((arg == "-d" || arg == "-n") && i + 1 < args.size()) {
+                    size_t value = 0;
+                    try {
+                        value = stoul(args[++i]);
+                    } catch (const exception&) {
+                        out << "Invalid number for " << arg << ": " << args[i] << "\n";
+                        return;
+                    }
+                    (arg == "-d" ? maxDepth : topN) = value;
+                } else if (target.empty()) {
+                    target = arg;
+                }
+            }
+
+            if (target.empty()) {
+                out << "Missing folder name: Please enter 'du [-x] [-d depth] [foldername]'\n";
                 return;
             }
 
-            fs::path dirPath = fsutil::normalizePath(ctx.currentDir, args[0]);
+            fs::path dirPath = resolvePath(ctx, target);
 
             // Check if path exists
             if (!fs::exists(dirPath)) {
-                cout << "Directory not found: " << args[0] << "\n";
+                out << "Directory not found: " << target << "\n";
                 return;
             }
 
             // Check if it's a directory
             if (!fs::is_directory(dirPath)) {
-                cout << "Not a directory: " << args[0] << "\n";
+                out << "Not a directory: " << target << "\n";
                 return;
             }
 
-            uintmax_t totalSize = fsutil::calcDirectorySize(dirPath);
-            cout << "Total size of " << args[0] << ": " << formatSizeAuto(totalSize) << "\n";
+            // Per-directory sizes come from the same walk as the total
+            shared_ptr<DuTree> tree;
+            if (maxDepth > 0 || keepTree) {
+                tree = make_shared<DuTree>(dirPath, defaultWorkerCount());
+            }
+
+            fsutil::DiskUsage usage =
+                fsutil::calcDiskUsage(dirPath, oneFileSystem, ctx.op.get(), tree.get());
+            out << "Total size of " << target << ": " << formatSizeAuto(usage.apparentBytes) << "\n";
+            out << "  Apparent size: " << usage.apparentBytes << " bytes\n";
+            out << "  Disk usage:    " << usage.allocatedBytes << " bytes ("
+                << formatSizeAuto(usage.allocatedBytes) << ")\n";
+            out << "  Files: " << usage.files << ", Directories: " << usage.dirs;
+            if (usage.hardlinksSkipped > 0) {
+                out << ", Extra hard links not counted: " << usage.hardlinksSkipped;
+            }
+            out << "\n";
+
+            if (tree) {
+                for (size_t depth = 1; depth <= min(maxDepth, tree->maxDepth()); ++depth) {
+                    out << "Largest at depth " << depth << ":\n";
+                    for (const DuNode* node : tree->heaviestAt(depth, topN)) {
+                        out << "  " << left << setw(10) << formatSizeAuto(node->apparent)
+                            << setw(12) << ("(" + formatSizeAuto(node->allocated) + ")")
+                            << tree->pathOf(node).lexically_relative(dirPath).string() << "\n";
+                    }
+                }
+            }
+
+            if (keepTree) {
+                ctx.duTree = tree;
+                out << "Kept directory sizes of " << target << " for ls -s\n";
+            }
         }
     );
 }
@@ -0,0 +1,177 @@
+#include "Completion.h"
+
+#include <algorithm>
+#include <cctype>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace fs = filesystem;
+
+// Candidates kept for listing; the rest are only counted
+static constexpr size_t kMaxShown = 100;
+
+shared_ptr<const vector<string>> DirNameCache::names(const fs::path& dir) {
+    struct stat st;
+    if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return nullptr;
+    }
+    int64_t mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    string key = dir.string();
+
+    for (auto& entry : entries_) {
+        if (entry.key == key) {
+            entry.lastUsed = ++clock_;
+            if (entry.mtimeNs == mtimeNs) {
+                return entry.names;
+            }
+            break;
+        }
+    }
+
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    DIR* d = fdopendir(fd);
+    if (!d) {
+        close(fd);
+        return nullptr;
+    }
+    auto list = make_shared<vector<string>>();
+    while (dirent* e = readdir(d)) {
+        const char* name = e->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+        bool isDir = e->d_type == DT_DIR;
+        if (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK) {
+            // Symlinks to directories complete like directories
+            struct stat target;
+            isDir = fstatat(dirfd(d), name, &target, 0) == 0 && S_ISDIR(target.st_mode);
+        }
+        list->emplace_back(name);
+        if (isDir) {
+            list->back().push_back('/');
+        }
+    }
+    closedir(d);
+    sort(list->begin(), list->end());
+
+    auto victim = find_if(entries_.begin(), entries_.end(),
+                          [&](const Entry& e) { return e.key == key; });
+    if (victim == entries_.end()) {
+        if (entries_.size() < capacity_) {
+            entries_.emplace_back();
+            victim = entries_.end() - 1;
+        } else {
+            victim = min_element(entries_.begin(), entries_.end(),
+                                 [](const Entry& a, const Entry& b) { return a.lastUsed < b.lastUsed; });
+        }
+    }
+    *victim = Entry{key, mtimeNs, ++clock_, list};
+    return list;
+}
+
+Completer::Completer(const CommandRegistry& registry, const fs::path& homeDir)
+    : homeDir_(homeDir) {
+    for (const auto& cmd : registry.all()) {
+        commands_.push_back(cmd.name);
+    }
+    sort(commands_.begin(), commands_.end());
+}
+
+// Everything in sorted starting with prefix is one contiguous range, and the
+// common prefix of a sorted range is that of its first and last element, so
+// the cost is two binary searches however many names match
+void Completer::completeIn(const vector<string>& sorted, const string& prefix,
+                           bool skipHidden, CompletionResult& result) const {
+    auto matches = [&](const string& s) { return s.compare(0, prefix.size(), prefix) == 0; };
+    auto first = lower_bound(sorted.begin(), sorted.end(), prefix);
+    auto last = partition_point(first, sorted.end(), matches);
+
+    auto addRange = [&](vector<string>::const_iterator begin, vector<string>::const_iterator end) {
+        if (begin == end) {
+            return;
+        }
+        const string& a = result.total == 0 ? *begin : result.replacement;
+        const string& b = *(end - 1);
+        size_t common = 0;
+        size_t limit = min(a.size(), b.size());
+        while (common < limit && a[common] == b[common]) {
+            ++common;
+        }
+        result.replacement = a.substr(0, common);
+        for (auto it = begin; it != end && result.shown.size() < kMaxShown; ++it) {
+            result.shown.push_back(*it);
+        }
+        result.total += static_cast<size_t>(end - begin);
+    };
+
+    if (skipHidden && prefix.empty()) {
+        // Dot names sort together, between "." and "/"
+        auto dotBegin = lower_bound(first, last, string("."));
+        auto dotEnd = lower_bound(dotBegin, last, string("/"));
+        addRange(first, dotBegin);
+        addRange(dotEnd, last);
+    } else {
+        addRange(first, last);
+    }
+    result.unique = result.total == 1;
+}
+
+CompletionResult Completer::complete(const string& line, size_t cursor,
+                                     const fs::path& currentDir) {
+    CompletionResult result;
+    cursor = min(cursor, line.size());
+
+    size_t start = cursor;
+    while (start > 0 && !isspace(static_cast<unsigned char>(line[start - 1]))) {
+        --start;
+    }
+    result.wordStart = start;
+    string word = line.substr(start, cursor - start);
+
+    bool firstWord = line.find_first_not_of(" \t") >= start;
+    if (firstWord) {
+        completeIn(commands_, word, false, result);
+        result.appendSpace = result.unique;
+        return result;
+    }
+
+    // Path: complete the last component inside the directory before it
+    size_t slash = word.rfind('/');
+    string dirPart = slash == string::npos ? "" : word.substr(0, slash + 1);
+    string namePart = slash == string::npos ? word : word.substr(slash + 1);
+
+    fs::path dir;
+    if (dirPart.empty()) {
+        dir = currentDir;
+    } else if (dirPart[0] == '~' && (dirPart.size() == 1 || dirPart[1] == '/')) {
+        dir = homeDir_ / dirPart.substr(dirPart.size() > 1 ? 2 : 1);
+    } else if (dirPart[0] == '/') {
+        dir = dirPart;
+    } else {
+        dir = currentDir / dirPart;
+    }
+
+    // One cache key per directory, with or without a trailing slash
+    string key = dir.lexically_normal().string();
+    while (key.size() > 1 && key.back() == '/') {
+        key.pop_back();
+    }
+    auto names = dirNames_.names(key);
+    if (!names) {
+        return result;
+    }
+    completeIn(*names, namePart, true, result);
+
+    // Replace the whole word, keeping what was typed before the last '/';
+    // candidates are listed without it, like a shell does
+    result.replacement = dirPart + result.replacement;
+    result.appendSpace = result.unique && result.replacement.back() != '/';
+    return result;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Command.h"
+
+using namespace std;
+
+struct CompletionResult {
+    size_t wordStart{0};       // Byte offset of the word being completed
+    string replacement;        // Longest common prefix of all candidates
+    bool unique{false};        // replacement is the only candidate
+    bool appendSpace{false};   // Complete word: a space may follow
+    vector<string> shown;      // The first candidates, for listing
+    size_t total{0};           // Candidates in all
+};
+
+// Small LRU of sorted name arrays, one per directory, revalidated by the
+// directory's mtime. Finding the candidates for a prefix is a binary search
+// into the array, so completion never re-lists a directory that has not
+// changed. Directory names carry a trailing '/'.
+class DirNameCache {
+public:
+    explicit DirNameCache(size_t capacity = 8) : capacity_(capacity) {}
+
+    // Sorted names of dir, read again only when its mtime changed; null if
+    // it cannot be read
+    shared_ptr<const vector<string>> names(const filesystem::path& dir);
+
+private:
+    struct Entry {
+        string key;
+        int64_t mtimeNs{0};
+        uint64_t lastUsed{0};
+        shared_ptr<const vector<string>> names;
+    };
+
+    size_t capacity_;
+    uint64_t clock_{0};
+    vector<Entry> entries_;
+};
+
+// Completes the word before the cursor: the first word of a line against
+// command names, later words against paths (relative, absolute or ~/).
+class Completer {
+public:
+    Completer(const CommandRegistry& registry, const filesystem::path& homeDir);
+
+    CompletionResult complete(const string& line, size_t cursor,
+                              const filesystem::path& currentDir);
+
+private:
+    void completeIn(const vector<string>& sorted, const string& prefix,
+                    bool skipHidden, CompletionResult& result) const;
+
+    vector<string> commands_;  // Sorted
+    filesystem::path homeDir_;
+    DirNameCache dirNames_;
+};
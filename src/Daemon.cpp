@@ -0,0 +1,561 @@
+#include "Daemon.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "App.h"
+
+using namespace std;
+
+namespace fs = filesystem;
+
+namespace {
+
+constexpr size_t kOutputBuffer = 64 * 1024;
+
+bool makeAddress(const fs::path& path, sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    const string& p = path.native();
+    if (p.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memcpy(addr.sun_path, p.c_str(), p.size() + 1);
+    return true;
+}
+
+int connectTo(const fs::path& path) {
+    sockaddr_un addr;
+    if (!makeAddress(path, addr)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+// The socket's directory must not let another user swap the socket for
+// their own: owned by us (or root), and not writable by others unless it is
+// sticky like /tmp
+bool checkSocketDir(const fs::path& dir, string& error) {
+    struct stat st;
+    if (lstat(dir.c_str(), &st) != 0) {
+        error = "cannot access " + dir.string() + ": " + strerror(errno);
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        error = dir.string() + " is not a directory";
+        return false;
+    }
+    if (st.st_uid != getuid() && st.st_uid != 0) {
+        error = dir.string() + " is owned by another user";
+        return false;
+    }
+    if ((st.st_mode & (S_IWGRP | S_IWOTH)) && !(st.st_mode & S_ISVTX)) {
+        error = dir.string() + " is writable by other users";
+        return false;
+    }
+    return true;
+}
+
+// Only talk to our own user at the other end of the socket
+bool peerIsSameUser(int fd) {
+    ucred cred{};
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+}
+
+bool sendAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Session input: a reader thread splits what the client sends into lines,
+// so an interrupt is seen even while the command is busy and not reading.
+class SocketInput : public streambuf {
+public:
+    SocketInput(int fd, OpControl& op) : fd_(fd), op_(op) {
+        reader_ = thread(&SocketInput::readerLoop, this);
+    }
+
+    // The owner shuts the socket down first, which ends the reader
+    ~SocketInput() {
+        if (reader_.joinable()) {
+            reader_.join();
+        }
+    }
+
+    // While a command runs, an interrupt cancels it and makes a pending
+    // confirmation read return EOF (which every prompt treats as "no")
+    void setCommandRunning(bool running) {
+        lock_guard<mutex> lock(mutex_);
+        commandRunning_ = running;
+        interrupted_ = false;
+    }
+
+protected:
+    int_type underflow() override {
+        unique_lock<mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return !lines_.empty() || closed_ || interrupted_; });
+        if (interrupted_) {
+            interrupted_ = false;
+            return traits_type::eof();
+        }
+        if (lines_.empty()) {
+            return traits_type::eof();
+        }
+        current_ = move(lines_.front());
+        lines_.pop_front();
+        current_.push_back('\n');
+        setg(&current_[0], &current_[0], &current_[0] + current_.size());
+        return traits_type::to_int_type(current_[0]);
+    }
+
+private:
+    void readerLoop() {
+        char buf[4096];
+        string partial;
+        for (;;) {
+            ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            partial.append(buf, static_cast<size_t>(n));
+            size_t start = 0;
+            size_t nl;
+            while ((nl = partial.find('\n', start)) != string::npos) {
+                string line = partial.substr(start, nl - start);
+                start = nl + 1;
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                lock_guard<mutex> lock(mutex_);
+                if (line.size() == 1 && line[0] == kInterruptByte) {
+                    if (commandRunning_) {
+                        interrupted_ = true;
+                        op_.cancel();
+                    }
+                } else if (line.size() == 1 && line[0] == kEndOfInput) {
+                    // Keep reading: an interrupt may still follow
+                    closed_ = true;
+                } else if (!closed_) {
+                    lines_.push_back(move(line));
+                }
+                cv_.notify_all();
+            }
+            partial.erase(0, start);
+        }
+
+        // Client gone: stop whatever it was running (e.g. watch)
+        lock_guard<mutex> lock(mutex_);
+        closed_ = true;
+        if (commandRunning_) {
+            op_.cancel();
+        }
+        cv_.notify_all();
+    }
+
+    int fd_;
+    OpControl& op_;
+    mutex mutex_;
+    condition_variable cv_;
+    deque<string> lines_;
+    bool closed_{false};
+    bool commandRunning_{false};
+    bool interrupted_{false};
+    string current_;
+    thread reader_;
+};
+
+// Session output, sent on flush or when the buffer fills
+class SocketOutput : public streambuf {
+public:
+    SocketOutput(int fd, OpControl& op) : fd_(fd), op_(op), buffer_(kOutputBuffer) {
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+
+    bool broken() const { return broken_; }
+
+protected:
+    int_type overflow(int_type ch) override {
+        flushBuffer();
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    int sync() override {
+        flushBuffer();
+        return 0;
+    }
+
+private:
+    void flushBuffer() {
+        size_t len = static_cast<size_t>(pptr() - pbase());
+        if (len > 0 && !broken_ && !sendAll(fd_, pbase(), len)) {
+            // Nobody is listening any more; output is dropped from here on
+            broken_ = true;
+            op_.cancel();
+        }
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+
+    int fd_;
+    OpControl& op_;
+    vector<char> buffer_;
+    bool broken_{false};
+};
+
+volatile sig_atomic_t clientInterrupted = 0;
+
+void onClientInterrupt(int) {
+    clientInterrupted = 1;
+}
+
+} // namespace
+
+fs::path defaultSocketPath() {
+    if (const char* runtime = getenv("XDG_RUNTIME_DIR")) {
+        if (*runtime) {
+            return fs::path(runtime) / "minifileexplorer.sock";
+        }
+    }
+    // A private per-user directory rather than a predictable socket name in
+    // /tmp; the daemon creates it with mode 0700
+    return fs::path("/tmp") / ("minifileexplorer-" + to_string(getuid())) / "daemon.sock";
+}
+
+Daemon::Daemon(fs::path socketPath, const CommandRegistry& registry,
+               const FileSystemContext& prototype)
+    : socketPath_(move(socketPath)), registry_(registry), prototype_(prototype) {}
+
+Daemon::~Daemon() {
+    if (listenFd_ >= 0) {
+        close(listenFd_);
+    }
+}
+
+int Daemon::run() {
+    sockaddr_un addr;
+    if (!makeAddress(socketPath_, addr)) {
+        cerr << "Socket path too long: " << socketPath_.string() << "\n";
+        return 1;
+    }
+
+    fs::path dir = socketPath_.parent_path();
+    if (dir.empty()) {
+        dir = ".";
+    }
+    if (mkdir(dir.c_str(), S_IRWXU) != 0 && errno != EEXIST) {
+        cerr << "Cannot create " << dir.string() << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    string dirError;
+    if (!checkSocketDir(dir, dirError)) {
+        cerr << "Refusing to use socket directory: " << dirError << "\n";
+        return 1;
+    }
+
+    // Refuse to steal the socket of a live daemon; remove a stale one
+    int probe = connectTo(socketPath_);
+    if (probe >= 0) {
+        close(probe);
+        cerr << "A daemon is already listening on " << socketPath_.string() << "\n";
+        return 1;
+    }
+    unlink(socketPath_.c_str());
+
+    // Sessions run with the daemon's permissions: the socket is owner only
+    // from the moment it exists (no threads yet, so the umask is ours)
+    listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool listening = false;
+    if (listenFd_ >= 0) {
+        mode_t oldMask = umask(S_IRWXG | S_IRWXO);
+        listening = bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+        int err = errno;
+        umask(oldMask);
+        errno = err;
+        listening = listening && listen(listenFd_, 64) == 0;
+    }
+    if (!listening) {
+        cerr << "Cannot listen on " << socketPath_.string() << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    // Every thread inherits a mask with SIGINT/SIGTERM blocked; a dedicated
+    // thread waits for them and wakes accept() by shutting the socket down
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    thread signalWaiter([this, stopSignals] {
+        int sig = 0;
+        sigwait(&stopSignals, &sig);
+        stopping_ = true;
+        shutdown(listenFd_, SHUT_RDWR);
+    });
+
+    cout << "MiniFileExplorer daemon listening on " << socketPath_.string() << endl;
+
+    while (!stopping_) {
+        int fd = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || stopping_) {
+                continue;
+            }
+            // Out of descriptors or similar: back off instead of spinning
+            this_thread::sleep_for(chrono::milliseconds(100));
+            continue;
+        }
+
+        if (!peerIsSameUser(fd)) {
+            close(fd);
+            continue;
+        }
+
+        reapFinished();
+        auto session = make_unique<Session>();
+        session->fd = fd;
+        session->op = make_shared<OpControl>();
+        Session* started = session.get();
+        {
+            lock_guard<mutex> lock(sessionsMutex_);
+            sessions_.push_back(move(session));
+        }
+        started->worker = thread([this, started] { serve(*started); });
+    }
+
+    signalWaiter.join();
+
+    // Cancel what is still running and hang up on every client
+    {
+        lock_guard<mutex> lock(sessionsMutex_);
+        for (auto& session : sessions_) {
+            session->op->cancel();
+            if (session->fd >= 0) {
+                shutdown(session->fd, SHUT_RDWR);
+            }
+        }
+    }
+    for (auto& session : sessions_) {
+        if (session->worker.joinable()) {
+            session->worker.join();
+        }
+    }
+    sessions_.clear();
+
+    unlink(socketPath_.c_str());
+    cout << "MiniFileExplorer daemon stopped" << endl;
+    return 0;
+}
+
+void Daemon::reapFinished() {
+    lock_guard<mutex> lock(sessionsMutex_);
+    for (auto it = sessions_.begin(); it != sessions_.end();) {
+        if ((*it)->finished) {
+            (*it)->worker.join();
+            it = sessions_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void Daemon::closeSession(Session& session) {
+    lock_guard<mutex> lock(sessionsMutex_);
+    close(session.fd);
+    session.fd = -1;
+}
+
+void Daemon::serve(Session& session) {
+    FileSystemContext ctx = prototype_;
+    ctx.op = session.op;
+    ctx.jobs = make_shared<JobTable>();
+
+    {
+        SocketOutput outBuf(session.fd, *ctx.op);
+        SocketInput inBuf(session.fd, *ctx.op);
+        ostream out(&outBuf);
+        istream in(&inBuf);
+        // Like cin and cout: a prompt is sent before waiting for the answer
+        in.tie(&out);
+        ctx.out = &out;
+        ctx.in = &in;
+
+        string line;
+        if (getline(in, line) && line.compare(0, 6, "HELLO ") == 0) {
+            error_code ec;
+            fs::path cwd = line.substr(6);
+            if (cwd.is_absolute() && fs::is_directory(cwd, ec)) {
+                ctx.currentDir = cwd;
+            }
+            out << kEndOfOutput << flush;
+
+            App app(ctx, registry_);
+            while (ctx.running && !outBuf.broken()) {
+                in.clear();
+                if (!getline(in, line)) {
+                    break;
+                }
+                inBuf.setCommandRunning(true);
+                try {
+                    app.executeLine(line);
+                } catch (const exception& e) {
+                    out << "Error: " << e.what() << "\n";
+                }
+                inBuf.setCommandRunning(false);
+                ctx.jobs->reportFinished(out);
+                out << kEndOfOutput << flush;
+            }
+        }
+
+        // Jobs write to their own buffers, but end them before the streams go
+        ctx.jobs.reset();
+        shutdown(session.fd, SHUT_RDWR);
+    }
+
+    closeSession(session);
+    session.finished = true;
+}
+
+int runClient(const fs::path& socketPath, const string& command) {
+    int fd = connectTo(socketPath);
+    if (fd < 0) {
+        cerr << "Cannot connect to daemon at " << socketPath.string() << ": "
+             << strerror(errno) << "\n";
+        return 1;
+    }
+    // Commands (and answers to prompts) must not go to someone else's server
+    if (!peerIsSameUser(fd)) {
+        cerr << "Refusing to talk to " << socketPath.string()
+             << ": the daemon there belongs to another user\n";
+        close(fd);
+        return 1;
+    }
+
+    error_code ec;
+    string hello = "HELLO " + fs::current_path(ec).string() + "\n";
+    bool oneShot = !command.empty();
+    if (oneShot) {
+        hello += command + "\n";
+    }
+    if (!sendAll(fd, hello.data(), hello.size())) {
+        cerr << "Lost connection to daemon\n";
+        close(fd);
+        return 1;
+    }
+
+    // Ctrl-C is forwarded as an interrupt line; no SA_RESTART so poll()
+    // returns at once
+    struct sigaction sa{};
+    sa.sa_handler = onClientInterrupt;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    bool interactive = !oneShot && isatty(STDIN_FILENO);
+    bool stdinOpen = true;
+    bool midLine = false;  // Last byte sent from stdin was not a newline
+    bool greeted = false;
+    char buf[65536];
+
+    for (;;) {
+        pollfd fds[2] = {{fd, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+        int n = poll(fds, stdinOpen ? 2 : 1, -1);
+        if (n < 0) {
+            if (errno != EINTR) break;
+            if (clientInterrupted) {
+                clientInterrupted = 0;
+                const char interrupt[] = {kInterruptByte, '\n'};
+                sendAll(fd, interrupt, sizeof(interrupt));
+            }
+            continue;
+        }
+
+        if (fds[0].revents) {
+            ssize_t got = recv(fd, buf, sizeof(buf), 0);
+            if (got <= 0) {
+                break;  // Daemon closed the session (exit, or shutting down)
+            }
+            size_t start = 0;
+            bool done = false;
+            for (size_t i = 0; i < static_cast<size_t>(got); ++i) {
+                if (buf[i] != kEndOfOutput) {
+                    continue;
+                }
+                cout.write(buf + start, static_cast<streamsize>(i - start));
+                start = i + 1;
+                if (!greeted) {
+                    greeted = true;  // Greeting done; the first command follows
+                } else if (oneShot) {
+                    done = true;
+                    break;
+                }
+                if (interactive) {
+                    cout << "mfe> ";
+                }
+            }
+            if (done) {
+                cout << flush;
+                break;
+            }
+            cout.write(buf + start, static_cast<streamsize>(got - static_cast<ssize_t>(start)));
+            cout << flush;
+        }
+
+        if (stdinOpen && fds[1].revents) {
+            ssize_t got = read(STDIN_FILENO, buf, sizeof(buf));
+            if (got > 0) {
+                if (!sendAll(fd, buf, static_cast<size_t>(got))) break;
+                midLine = buf[got - 1] != '\n';
+            } else if (got == 0 || errno != EINTR) {
+                // No more input: prompts now read as "no", and the daemon
+                // ends the session after the commands already sent. The
+                // socket stays open for Ctrl-C.
+                stdinOpen = false;
+                string endOfInput = midLine ? "\n" : "";
+                endOfInput += kEndOfInput;
+                endOfInput += '\n';
+                if (!sendAll(fd, endOfInput.data(), endOfInput.size())) break;
+            }
+        }
+    }
+
+    close(fd);
+    return 0;
+}
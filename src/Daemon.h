@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Command.h"
+#include "FileSystemContext.h"
+
+using namespace std;
+
+// Wire protocol, one Unix stream connection per session:
+//   client -> server: "HELLO <cwd>\n", then command lines and answers to
+//                     confirmation prompts exactly as typed; a line holding
+//                     only kInterruptByte cancels the running command, one
+//                     holding only kEndOfInput says no more lines will come
+//   server -> client: command output, with kEndOfOutput after the greeting
+//                     and after each command
+constexpr char kInterruptByte = '\x03';
+constexpr char kEndOfInput = '\x04';
+constexpr char kEndOfOutput = '\0';
+
+// $XDG_RUNTIME_DIR/minifileexplorer.sock, else /tmp/minifileexplorer-<uid>/daemon.sock
+filesystem::path defaultSocketPath();
+
+// Resident server: keeps the command registry and the shared caches of
+// `prototype` (directory and path caches) warm across many short-lived
+// clients. Each client session runs on its own thread with its own
+// FileSystemContext: working directory, settings, OpControl and job table.
+class Daemon {
+public:
+    Daemon(filesystem::path socketPath, const CommandRegistry& registry,
+           const FileSystemContext& prototype);
+    ~Daemon();
+
+    Daemon(const Daemon&) = delete;
+    Daemon& operator=(const Daemon&) = delete;
+
+    // Serve until SIGINT or SIGTERM; returns the process exit code
+    int run();
+
+private:
+    struct Session {
+        int fd{-1};
+        shared_ptr<OpControl> op;
+        thread worker;
+        atomic<bool> finished{false};
+    };
+
+    void serve(Session& session);
+    void reapFinished();
+    void closeSession(Session& session);
+
+    filesystem::path socketPath_;
+    const CommandRegistry& registry_;
+    const FileSystemContext& prototype_;
+    int listenFd_{-1};
+    atomic<bool> stopping_{false};
+
+    mutex sessionsMutex_;  // Also guards each Session::fd
+    std::list<unique_ptr<Session>> sessions_;
+};
+
+// Thin client: forwards `command` (or, when empty, every line of stdin) to
+// a running daemon and prints the output. Ctrl-C cancels the remote
+// command. Returns the process exit code.
+int runClient(const filesystem::path& socketPath, const string& command);
@@ -0,0 +1,229 @@
+#include "DirCache.h"
+
+#include <sys/stat.h>
+
+#include "FsUtil.h"
+
+using namespace std;
+
+namespace fs = filesystem;
+
+// Listings bigger than this are served but never kept, so a single huge
+// directory cannot blow the cache's memory bound.
+static constexpr size_t kMaxCachedEntries = 200000;
+
+DirCache::DirCache(size_t capacity, chrono::seconds maxAge)
+    : capacity_(capacity), maxAge_(maxAge) {}
+
+DirCache::~DirCache() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopping_ = true;
+        jobs_.clear();
+    }
+    jobCv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+DirCache::Stamp DirCache::stampOf(const fs::path& dir) {
+    Stamp stamp;
+    struct stat st;
+    if (stat(dir.c_str(), &st) == 0) {
+        stamp.sec = st.st_mtim.tv_sec;
+        stamp.nsec = st.st_mtim.tv_nsec;
+    }
+    return stamp;
+}
+
+bool DirCache::lookupLocked(const string& key, const Stamp& stamp, Listing& out) {
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return false;
+    }
+
+    auto entryIt = it->second;
+    bool expired = chrono::steady_clock::now() - entryIt->loadedAt > maxAge_;
+    if (stamp.sec < 0 || !(entryIt->stamp == stamp) || expired) {
+        lru_.erase(entryIt);
+        index_.erase(it);
+        return false;
+    }
+
+    lru_.splice(lru_.begin(), lru_, entryIt);
+    out = entryIt->entries;
+    return true;
+}
+
+void DirCache::storeLocked(const string& key, const Stamp& stamp, Listing entries) {
+    if (capacity_ == 0 || stamp.sec < 0 || entries->size() > kMaxCachedEntries) {
+        return;
+    }
+
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+
+    lru_.push_front(Entry{key, stamp, chrono::steady_clock::now(), move(entries)});
+    index_[key] = lru_.begin();
+
+    while (lru_.size() > capacity_) {
+        index_.erase(lru_.back().key);
+        lru_.pop_back();
+    }
+}
+
+vector<FileInfo> DirCache::list(const fs::path& dir) {
+    string key = dir.string();
+    // Take the stamp before enumerating so a change made during the listing
+    // shows up as stale on the next lookup
+    Stamp stamp = stampOf(dir);
+    Listing cached;
+
+    {
+        unique_lock<mutex> lock(mutex_);
+        loadedCv_.wait(lock, [&] { return inFlight_.count(key) == 0; });
+        if (lookupLocked(key, stamp, cached)) {
+            ++hits_;
+            lock.unlock();
+            // Copy outside the lock so concurrent readers don't serialise
+            return *cached;
+        }
+        ++misses_;
+        inFlight_.insert(key);
+    }
+
+    vector<FileInfo> result;
+    try {
+        result = fsutil::listDirectory(dir);
+    } catch (...) {
+        {
+            lock_guard<mutex> lock(mutex_);
+            inFlight_.erase(key);
+        }
+        loadedCv_.notify_all();
+        throw;
+    }
+
+    Listing listing = make_shared<const vector<FileInfo>>(result);
+    {
+        lock_guard<mutex> lock(mutex_);
+        storeLocked(key, stamp, move(listing));
+        inFlight_.erase(key);
+    }
+    loadedCv_.notify_all();
+    return result;
+}
+
+void DirCache::prefetch(const fs::path& dir, size_t readAhead) {
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (stopping_) {
+            return;
+        }
+        // A new cd makes any pending read-ahead for the old directory useless
+        jobs_.clear();
+        ++generation_;
+        jobs_.push_back(Job{dir, readAhead, generation_});
+        if (!worker_.joinable()) {
+            worker_ = thread(&DirCache::workerLoop, this);
+        }
+    }
+    jobCv_.notify_one();
+}
+
+void DirCache::invalidate(const fs::path& dir) {
+    lock_guard<mutex> lock(mutex_);
+    auto it = index_.find(dir.string());
+    if (it != index_.end()) {
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+}
+
+void DirCache::clear() {
+    lock_guard<mutex> lock(mutex_);
+    lru_.clear();
+    index_.clear();
+}
+
+uint64_t DirCache::hits() const {
+    lock_guard<mutex> lock(mutex_);
+    return hits_;
+}
+
+uint64_t DirCache::misses() const {
+    lock_guard<mutex> lock(mutex_);
+    return misses_;
+}
+
+void DirCache::workerLoop() {
+    for (;;) {
+        Job job;
+        {
+            unique_lock<mutex> lock(mutex_);
+            jobCv_.wait(lock, [&] { return stopping_ || !jobs_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            job = move(jobs_.front());
+            jobs_.pop_front();
+        }
+
+        string key = job.dir.string();
+        Stamp stamp = stampOf(job.dir);
+        Listing entries;
+        bool needLoad = false;
+
+        {
+            lock_guard<mutex> lock(mutex_);
+            if (inFlight_.count(key) == 0 && !lookupLocked(key, stamp, entries)) {
+                inFlight_.insert(key);
+                needLoad = true;
+            }
+        }
+
+        if (needLoad) {
+            try {
+                entries = make_shared<const vector<FileInfo>>(fsutil::listDirectory(job.dir));
+            } catch (const exception&) {
+                // Unreadable directory: cache nothing, so the foreground list()
+                // enumerates it itself and reports the error
+                entries.reset();
+            }
+            {
+                lock_guard<mutex> lock(mutex_);
+                if (entries) {
+                    storeLocked(key, stamp, entries);
+                }
+                inFlight_.erase(key);
+            }
+            loadedCv_.notify_all();
+        }
+
+        // entries is null if the load failed or another thread is already
+        // loading this directory
+        if (job.readAhead == 0 || !entries) {
+            continue;
+        }
+
+        // Shallow read-ahead: queue the immediate subdirectories only
+        lock_guard<mutex> lock(mutex_);
+        if (job.generation != generation_) {
+            continue;
+        }
+        size_t queued = 0;
+        for (const auto& entry : *entries) {
+            if (queued == job.readAhead) {
+                break;
+            }
+            if (entry.isDirectory) {
+                jobs_.push_back(Job{entry.path, 0, job.generation});
+                ++queued;
+            }
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "FileInfo.h"
+
+using namespace std;
+
+// Bounded LRU cache of directory listings.
+// An entry is valid while the directory mtime is unchanged; since editing a
+// file in place does not touch its parent's mtime, entries also expire after
+// maxAge so per-file sizes/times shown by ls cannot lag indefinitely.
+class DirCache {
+public:
+    explicit DirCache(size_t capacity = 64,
+                      chrono::seconds maxAge = chrono::seconds(10));
+    ~DirCache();
+
+    DirCache(const DirCache&) = delete;
+    DirCache& operator=(const DirCache&) = delete;
+
+    // Return the listing of dir, from the cache when still fresh.
+    // Waits for an in-flight prefetch of the same directory instead of
+    // enumerating it twice.
+    vector<FileInfo> list(const filesystem::path& dir);
+
+    // Queue a background load of dir and, if readAhead > 0, of up to
+    // readAhead of its immediate subdirectories. Supersedes earlier requests.
+    void prefetch(const filesystem::path& dir, size_t readAhead);
+
+    void invalidate(const filesystem::path& dir);
+    void clear();
+
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+private:
+    struct Stamp {
+        int64_t sec{-1};
+        int64_t nsec{0};
+        bool operator==(const Stamp& o) const { return sec == o.sec && nsec == o.nsec; }
+    };
+
+    struct Entry {
+        string key;
+        Stamp stamp;
+        chrono::steady_clock::time_point loadedAt;
+        // Immutable once stored: readers copy it outside the lock
+        shared_ptr<const vector<FileInfo>> entries;
+    };
+
+    struct Job {
+        filesystem::path dir;
+        size_t readAhead{0};
+        uint64_t generation{0};
+    };
+
+    static Stamp stampOf(const filesystem::path& dir);
+    using Listing = shared_ptr<const vector<FileInfo>>;
+
+    bool lookupLocked(const string& key, const Stamp& stamp, Listing& out);
+    void storeLocked(const string& key, const Stamp& stamp, Listing entries);
+    void workerLoop();
+
+    size_t capacity_;
+    chrono::seconds maxAge_;
+
+    mutable mutex mutex_;
+    condition_variable loadedCv_;
+    condition_variable jobCv_;
+    std::list<Entry> lru_;  // front = most recently used
+    unordered_map<string, std::list<Entry>::iterator> index_;
+    unordered_set<string> inFlight_;
+    deque<Job> jobs_;
+    uint64_t hits_{0};
+    uint64_t misses_{0};
+    uint64_t generation_{0};
+    bool stopping_{false};
+    thread worker_;
+};
@@ -0,0 +1,103 @@
+#include "DuTree.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace fs = filesystem;
+
+DuTree::DuTree(const fs::path& root, unsigned slots)
+    : rootPath_(root), builtAt_(time(nullptr)), slots_(max(1u, slots)) {
+    slots_[0].push_back(DuNode{});
+    root_ = &slots_[0].back();
+    root_->name = root.filename().string();
+}
+
+DuNode* DuTree::addNode(unsigned slot, DuNode* parent, const string& name) {
+    auto& storage = slots_[slot];
+    storage.push_back(DuNode{});
+    DuNode* node = &storage.back();
+    node->name = name;
+    node->parent = parent;
+    node->depth = parent ? parent->depth + 1 : 0;
+    return node;
+}
+
+void DuTree::finalize() {
+    byDepth_.clear();
+    for (auto& storage : slots_) {
+        for (auto& node : storage) {
+            if (byDepth_.size() <= node.depth) {
+                byDepth_.resize(node.depth + 1);
+            }
+            byDepth_[node.depth].push_back(&node);
+            node.apparent = node.ownApparent;
+            node.allocated = node.ownAllocated;
+            node.children.clear();
+        }
+    }
+
+    // Post-order without recursion: a level is complete once every deeper
+    // level has been added into it
+    for (size_t depth = byDepth_.size(); depth-- > 1;) {
+        for (const DuNode* node : byDepth_[depth]) {
+            DuNode* parent = node->parent;
+            parent->apparent += node->apparent;
+            parent->allocated += node->allocated;
+            parent->children.push_back(node);
+        }
+    }
+
+    for (auto& storage : slots_) {
+        for (auto& node : storage) {
+            sort(node.children.begin(), node.children.end(),
+                 [](const DuNode* a, const DuNode* b) { return a->name < b->name; });
+        }
+    }
+}
+
+const DuNode* DuTree::find(const fs::path& p) const {
+    fs::path rel = p.lexically_relative(rootPath_);
+    if (rel.empty() || *rel.begin() == "..") {
+        return nullptr;
+    }
+
+    const DuNode* node = root_;
+    for (const auto& part : rel) {
+        if (part == ".") {
+            continue;
+        }
+        string name = part.string();
+        auto it = lower_bound(node->children.begin(), node->children.end(), name,
+                              [](const DuNode* n, const string& key) { return n->name < key; });
+        if (it == node->children.end() || (*it)->name != name) {
+            return nullptr;
+        }
+        node = *it;
+    }
+    return node;
+}
+
+fs::path DuTree::pathOf(const DuNode* node) const {
+    vector<const DuNode*> chain;
+    for (; node && node != root_; node = node->parent) {
+        chain.push_back(node);
+    }
+    fs::path p = rootPath_;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        p /= (*it)->name;
+    }
+    return p;
+}
+
+vector<const DuNode*> DuTree::heaviestAt(size_t depth, size_t topN) const {
+    if (depth >= byDepth_.size()) {
+        return {};
+    }
+    vector<const DuNode*> nodes = byDepth_[depth];
+    size_t n = min(topN, nodes.size());
+    partial_sort(nodes.begin(), nodes.begin() + n, nodes.end(),
+                 [](const DuNode* a, const DuNode* b) { return a->apparent > b->apparent; });
+    nodes.resize(n);
+    return nodes;
+}
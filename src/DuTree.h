@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct DuNode {
+    string name;
+    DuNode* parent{nullptr};
+    size_t depth{0};
+    // Files directly inside this directory (allocated includes the
+    // directory's own blocks)
+    uintmax_t ownApparent{0};
+    uintmax_t ownAllocated{0};
+    // Whole subtree; valid after DuTree::finalize()
+    uintmax_t apparent{0};
+    uintmax_t allocated{0};
+    vector<const DuNode*> children;  // Sorted by name after finalize()
+};
+
+// Per-directory sizes of a tree, filled in by one parallel walk and then
+// summed bottom-up once. Kept by 'du --keep' so ls -s can answer from it.
+class DuTree {
+public:
+    DuTree(const filesystem::path& root, unsigned slots);
+
+    DuTree(const DuTree&) = delete;
+    DuTree& operator=(const DuTree&) = delete;
+
+    DuNode* root() { return root_; }
+    const filesystem::path& rootPath() const { return rootPath_; }
+    time_t builtAt() const { return builtAt_; }
+    unsigned slotCount() const { return static_cast<unsigned>(slots_.size()); }
+
+    // Safe to call concurrently as long as each thread uses its own slot.
+    // Returned pointers stay valid for the tree's lifetime.
+    DuNode* addNode(unsigned slot, DuNode* parent, const string& name);
+
+    // Accumulate every node into its parent, deepest level first, and index
+    // the nodes by depth
+    void finalize();
+
+    // Node for a path inside the tree, or nullptr
+    const DuNode* find(const filesystem::path& p) const;
+
+    filesystem::path pathOf(const DuNode* node) const;
+
+    size_t maxDepth() const { return byDepth_.empty() ? 0 : byDepth_.size() - 1; }
+
+    // The topN biggest subtrees (by apparent size) at the given depth
+    vector<const DuNode*> heaviestAt(size_t depth, size_t topN) const;
+
+private:
+    filesystem::path rootPath_;
+    time_t builtAt_;
+    vector<deque<DuNode>> slots_;  // deque: growing never moves nodes
+    DuNode* root_;
+    vector<vector<const DuNode*>> byDepth_;
+};
@@ -0,0 +1,405 @@
+#include "ExternalSort.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace std;
+
+namespace fs = filesystem;
+
+// Runs merged at once; more runs take an extra pass over the data
+static constexpr size_t kMaxFanIn = 64;
+static constexpr size_t kMinReadBuffer = 64 * 1024;
+static constexpr size_t kMaxReadBuffer = 4 * 1024 * 1024;
+static constexpr size_t kWriteBuffer = 1024 * 1024;
+
+namespace {
+
+void appendU32(string& out, uint32_t v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void appendU64(string& out, uint64_t v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+uint32_t loadU32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t loadU64(const char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+string bigEndian(uint64_t v) {
+    string key(8, '\0');
+    for (int i = 7; i >= 0; --i) {
+        key[i] = static_cast<char>(v & 0xff);
+        v >>= 8;
+    }
+    return key;
+}
+
+uint64_t keyPrefix(const char* key, size_t len) {
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        prefix = (prefix << 8) | (i < len ? static_cast<unsigned char>(key[i]) : 0);
+    }
+    return prefix;
+}
+
+// Packed record: u32 keyLen, key, u32 recLen, then the record itself:
+// u8 isDirectory, u64 size, i64 mtime/atime/ctime, path bytes. The name is
+// derived from the path when decoding.
+constexpr size_t kFixedRecordBytes = 1 + 4 * 8;
+
+size_t packedSize(const char* p) {
+    uint32_t keyLen = loadU32(p);
+    uint32_t recLen = loadU32(p + 4 + keyLen);
+    return 8 + keyLen + recLen;
+}
+
+void packRecord(string& out, const string& key, const FileInfo& info) {
+    const string& path = info.path.native();
+    appendU32(out, static_cast<uint32_t>(key.size()));
+    out += key;
+    appendU32(out, static_cast<uint32_t>(kFixedRecordBytes + path.size()));
+    out.push_back(info.isDirectory ? 1 : 0);
+    appendU64(out, info.size);
+    appendU64(out, static_cast<uint64_t>(info.mtime));
+    appendU64(out, static_cast<uint64_t>(info.atime));
+    appendU64(out, static_cast<uint64_t>(info.ctime));
+    out += path;
+}
+
+void unpackRecord(const char* p, FileInfo& info) {
+    uint32_t keyLen = loadU32(p);
+    const char* rec = p + 4 + keyLen + 4;
+    uint32_t recLen = loadU32(p + 4 + keyLen);
+    info.isDirectory = rec[0] != 0;
+    info.size = loadU64(rec + 1);
+    info.mtime = static_cast<time_t>(loadU64(rec + 9));
+    info.atime = static_cast<time_t>(loadU64(rec + 17));
+    info.ctime = static_cast<time_t>(loadU64(rec + 25));
+    info.path = string(rec + kFixedRecordBytes, recLen - kFixedRecordBytes);
+    info.name = info.path.filename().string();
+}
+
+// Compares the keys of two packed records
+int compareKeys(const char* a, const char* b) {
+    uint32_t la = loadU32(a);
+    uint32_t lb = loadU32(b);
+    int c = memcmp(a + 4, b + 4, min(la, lb));
+    if (c != 0) return c;
+    return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+class RunWriter {
+public:
+    explicit RunWriter(int fd) : fd_(fd) { buffer_.reserve(kWriteBuffer); }
+
+    void write(const char* data, size_t len) {
+        buffer_.append(data, len);
+        if (buffer_.size() >= kWriteBuffer) flush();
+    }
+
+    void flush() {
+        size_t done = 0;
+        while (done < buffer_.size()) {
+            ssize_t n = ::pwrite(fd_, buffer_.data() + done, buffer_.size() - done,
+                                 static_cast<off_t>(written_ + done));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw runtime_error(string("sort spill failed: ") + strerror(errno));
+            }
+            done += static_cast<size_t>(n);
+        }
+        written_ += done;
+        buffer_.clear();
+    }
+
+    uintmax_t written() const { return written_ + buffer_.size(); }
+
+private:
+    int fd_;
+    string buffer_;
+    uintmax_t written_{0};
+};
+
+class RunReader {
+public:
+    RunReader(int fd, uintmax_t bytes, size_t bufferSize)
+        : fd_(fd), end_(bytes), buffer_(bufferSize) {}
+
+    // Load the next packed record into current(); false at the end of the run
+    bool next() {
+        if (pos_ >= end_) {
+            done_ = true;
+            return false;
+        }
+        char header[4];
+        read(header, 4);
+        uint32_t keyLen = loadU32(header);
+        current_.resize(4 + keyLen + 4);
+        memcpy(&current_[0], header, 4);
+        read(&current_[4], keyLen + 4);
+        uint32_t recLen = loadU32(&current_[4 + keyLen]);
+        size_t fixed = current_.size();
+        current_.resize(fixed + recLen);
+        read(&current_[fixed], recLen);
+        prefix_ = keyPrefix(current_.data() + 4, keyLen);
+        return true;
+    }
+
+    bool done() const { return done_; }
+    const string& current() const { return current_; }
+    uint64_t prefix() const { return prefix_; }
+
+private:
+    void read(char* dst, size_t len) {
+        while (len > 0) {
+            if (bufPos_ == bufLen_) fill();
+            size_t n = min(len, bufLen_ - bufPos_);
+            memcpy(dst, buffer_.data() + bufPos_, n);
+            bufPos_ += n;
+            pos_ += n;
+            dst += n;
+            len -= n;
+        }
+    }
+
+    void fill() {
+        ssize_t n;
+        do {
+            n = ::pread(fd_, buffer_.data(), buffer_.size(), static_cast<off_t>(filePos_));
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+            throw runtime_error(n < 0 ? string("sort run read failed: ") + strerror(errno)
+                                      : string("sort run truncated"));
+        }
+        filePos_ += static_cast<uintmax_t>(n);
+        bufPos_ = 0;
+        bufLen_ = static_cast<size_t>(n);
+    }
+
+    int fd_;
+    uintmax_t end_;
+    uintmax_t pos_{0};      // Logical position in the run
+    uintmax_t filePos_{0};  // Next offset to read from the file
+    vector<char> buffer_;
+    size_t bufPos_{0};
+    size_t bufLen_{0};
+    string current_;
+    uint64_t prefix_{0};
+    bool done_{false};
+};
+
+// Tournament tree over k sorted sources: tree_[0] holds the index of the
+// smallest current record and each inner node the loser of its match, so
+// replacing the winner costs one comparison per level (log2 k).
+class LoserTree {
+public:
+    explicit LoserTree(vector<RunReader>& sources) : sources_(sources), k_(sources.size()) {
+        tree_.assign(max<size_t>(k_, 1), k_);  // k_ marks an empty node
+        for (size_t i = k_; i-- > 0;) {
+            sources_[i].next();
+            insert(i);
+        }
+    }
+
+    bool empty() const { return k_ == 0 || sources_[tree_[0]].done(); }
+    RunReader& top() { return sources_[tree_[0]]; }
+
+    // Advance the winning source and replay its path to the root
+    void pop() {
+        size_t s = tree_[0];
+        sources_[s].next();
+        for (size_t t = (s + k_) / 2; t > 0; t /= 2) {
+            if (beats(tree_[t], s)) swap(tree_[t], s);
+        }
+        tree_[0] = s;
+    }
+
+private:
+    void insert(size_t s) {
+        size_t t = (s + k_) / 2;
+        for (; t > 0; t /= 2) {
+            if (tree_[t] == k_) {
+                tree_[t] = s;  // Wait here for the other subtree's winner
+                return;
+            }
+            if (beats(tree_[t], s)) swap(tree_[t], s);
+        }
+        tree_[0] = s;
+    }
+
+    // Exhausted sources lose everything; ties go to the earlier run, which
+    // keeps the merge stable
+    bool beats(size_t a, size_t b) const {
+        const RunReader& ra = sources_[a];
+        const RunReader& rb = sources_[b];
+        if (ra.done()) return false;
+        if (rb.done()) return true;
+        if (ra.prefix() != rb.prefix()) return ra.prefix() < rb.prefix();
+        int c = compareKeys(ra.current().data(), rb.current().data());
+        return c != 0 ? c < 0 : a < b;
+    }
+
+    vector<RunReader>& sources_;
+    size_t k_;
+    vector<size_t> tree_;
+};
+
+} // namespace
+
+string sortKeyDescending(uintmax_t value) {
+    return bigEndian(~static_cast<uint64_t>(value));
+}
+
+string sortKeyNewestFirst(time_t value) {
+    // Flip the sign bit so negative times order below positive ones
+    return bigEndian(~(static_cast<uint64_t>(value) ^ (1ull << 63)));
+}
+
+ExternalSorter::ExternalSorter(size_t memoryBudget, fs::path tempDir, OpControl* ctl)
+    : memoryBudget_(memoryBudget), tempDir_(move(tempDir)), ctl_(ctl) {}
+
+ExternalSorter::~ExternalSorter() {
+    // Run files were unlinked when created; closing them frees the space
+    for (const auto& run : runs_) {
+        if (run.fd >= 0) close(run.fd);
+    }
+}
+
+void ExternalSorter::add(const string& key, const FileInfo& info) {
+    size_t offset = arena_.size();
+    packRecord(arena_, key, info);
+    slots_.push_back(Slot{keyPrefix(key.data(), key.size()), offset});
+    ++count_;
+
+    if (arena_.size() + slots_.size() * sizeof(Slot) > memoryBudget_) {
+        spill();
+    }
+}
+
+bool ExternalSorter::slotLess(const Slot& a, const Slot& b) const {
+    if (a.prefix != b.prefix) return a.prefix < b.prefix;
+    int c = compareKeys(arena_.data() + a.offset, arena_.data() + b.offset);
+    // Records are appended in order, so the offset breaks ties stably
+    return c != 0 ? c < 0 : a.offset < b.offset;
+}
+
+void ExternalSorter::sortSlots() {
+    sort(slots_.begin(), slots_.end(),
+         [this](const Slot& a, const Slot& b) { return slotLess(a, b); });
+}
+
+ExternalSorter::Run ExternalSorter::createRun() {
+    string pattern = (tempDir_ / "mfe-sort-XXXXXX").string();
+    int fd = mkostemp(&pattern[0], O_CLOEXEC);
+    if (fd < 0) {
+        throw runtime_error("cannot create sort run in " + tempDir_.string() + ": " +
+                            strerror(errno));
+    }
+    unlink(pattern.c_str());
+    return Run{fd, 0};
+}
+
+void ExternalSorter::spill() {
+    if (slots_.empty()) return;
+    sortSlots();
+
+    Run run = createRun();
+    runs_.push_back(run);
+    ++spilledRuns_;
+    RunWriter writer(run.fd);
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        if (ctl_ && (i & 4095) == 0) ctl_->checkCancelled();
+        const char* p = arena_.data() + slots_[i].offset;
+        writer.write(p, packedSize(p));
+    }
+    writer.flush();
+    runs_.back().bytes = writer.written();
+
+    // Give the memory back rather than keeping the high-water mark
+    string().swap(arena_);
+    vector<Slot>().swap(slots_);
+}
+
+void ExternalSorter::mergeRuns(vector<Run> runs,
+                               const function<void(const string& packed)>& emit) {
+    size_t bufferSize = memoryBudget_ / (runs.size() + 1);
+    bufferSize = min(max(bufferSize, kMinReadBuffer), kMaxReadBuffer);
+
+    vector<RunReader> readers;
+    readers.reserve(runs.size());
+    for (const auto& run : runs) {
+        readers.emplace_back(run.fd, run.bytes, bufferSize);
+    }
+
+    LoserTree tree(readers);
+    for (uint64_t n = 0; !tree.empty(); ++n) {
+        if (ctl_ && (n & 4095) == 0) ctl_->checkCancelled();
+        emit(tree.top().current());
+        tree.pop();
+    }
+}
+
+void ExternalSorter::finish(const function<void(const FileInfo&)>& emit) {
+    FileInfo info;
+
+    if (runs_.empty()) {
+        sortSlots();
+        for (const auto& slot : slots_) {
+            unpackRecord(arena_.data() + slot.offset, info);
+            emit(info);
+        }
+        return;
+    }
+
+    spill();
+
+    // Too many runs to merge at once: merge consecutive groups into longer
+    // runs first (consecutive, so ties still come out in insertion order)
+    while (runs_.size() > kMaxFanIn) {
+        vector<Run> next;
+        size_t total = runs_.size();
+        for (size_t begin = 0; begin < total; begin += kMaxFanIn) {
+            size_t end = min(total, begin + kMaxFanIn);
+            vector<Run> group(runs_.begin() + begin, runs_.begin() + end);
+            if (group.size() == 1) {
+                next.push_back(group[0]);
+                continue;
+            }
+            // Keep every open fd in runs_ so the destructor closes it
+            // if the pass fails halfway
+            runs_.push_back(createRun());
+            Run& merged = runs_.back();
+            RunWriter writer(merged.fd);
+            mergeRuns(group, [&](const string& packed) {
+                writer.write(packed.data(), packed.size());
+            });
+            writer.flush();
+            merged.bytes = writer.written();
+            next.push_back(merged);
+            for (size_t i = begin; i < end; ++i) {
+                close(runs_[i].fd);
+                runs_[i].fd = -1;
+            }
+        }
+        runs_ = move(next);
+    }
+
+    mergeRuns(runs_, [&](const string& packed) {
+        unpackRecord(packed.data(), info);
+        emit(info);
+    });
+}
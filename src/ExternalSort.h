@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "FileInfo.h"
+#include "OpControl.h"
+
+using namespace std;
+
+// Sort keys are byte strings compared with memcmp, so any order can be
+// expressed by encoding it (big-endian integers, raw path bytes, ...)
+string sortKeyDescending(uintmax_t value);
+string sortKeyNewestFirst(time_t value);
+
+// Sorts FileInfo records by key within a memory budget. Records are packed
+// as compact key+record byte strings; while they fit in the budget the sort
+// is purely in memory. Beyond it, sorted runs are spilled to unlinked files
+// in tempDir and finish() k-way merges them with a loser tree, streaming
+// records out without ever holding the whole set. Equal keys keep their
+// insertion order.
+class ExternalSorter {
+public:
+    ExternalSorter(size_t memoryBudget, filesystem::path tempDir, OpControl* ctl = nullptr);
+    ~ExternalSorter();
+
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+
+    void add(const string& key, const FileInfo& info);
+
+    // Emit every record in key order. Call once, after the last add().
+    void finish(const function<void(const FileInfo&)>& emit);
+
+    uint64_t count() const { return count_; }
+    // Sorted runs spilled to disk (0 when everything fit in memory)
+    size_t runCount() const { return spilledRuns_; }
+
+private:
+    struct Slot {
+        uint64_t prefix;  // First 8 key bytes, big-endian, for cheap compares
+        size_t offset;    // Start of the packed record in arena_
+    };
+    struct Run {
+        int fd{-1};
+        uintmax_t bytes{0};
+    };
+
+    bool slotLess(const Slot& a, const Slot& b) const;
+    void sortSlots();
+    void spill();
+    Run createRun();
+    void mergeRuns(vector<Run> runs, const function<void(const string& packed)>& emit);
+
+    size_t memoryBudget_;
+    filesystem::path tempDir_;
+    OpControl* ctl_;
+
+    string arena_;        // Packed records: keyLen key recLen record
+    vector<Slot> slots_;
+    vector<Run> runs_;
+    size_t spilledRuns_{0};
+    uint64_t count_{0};
+};
@@ -1,6 +1,14 @@
 #pragma once
 
 #include <filesystem>
+#include <iostream>
+#include <memory>
+
+#include "DirCache.h"
+#include "DuTree.h"
+#include "Jobs.h"
+#include "PathCache.h"
+#include "OpControl.h"
 
 using namespace std;
 
@@ -8,4 +16,25 @@ struct FileSystemContext {
     filesystem::path currentDir;
     filesystem::path homeDir;
     bool running{true};
+
+    // Where command handlers print and read confirmations; background jobs
+    // point these at a per-job buffer and an empty input
+    ostream* out{&cout};
+    istream* in{&cin};
+
+    // Session settings (see the 'set' command)
+    bool prefetchOnCd{true};
+    size_t prefetchReadAhead{16};
+    // Sorted listings (ls -s/-t, search) spill to sortTempDir beyond this
+    size_t sortMemory{256 * 1024 * 1024};
+    filesystem::path sortTempDir{"/tmp"};
+
+    shared_ptr<DirCache> dirCache;
+    shared_ptr<PathCache> pathCache;
+    // Last tree kept by 'du --keep'; ls -s takes directory sizes from it
+    shared_ptr<const DuTree> duTree;
+    // Cancellation/progress for the command currently executing
+    shared_ptr<OpControl> op;
+    // Background jobs of this session (null inside a job)
+    shared_ptr<JobTable> jobs;
 };
@@ -0,0 +1,441 @@
+#include "FileView.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace fs = filesystem;
+
+// Index granularity: one 8-byte counter per block
+static constexpr uint64_t kBlockSize = 1024 * 1024;
+// pread window when the file is not mapped
+static constexpr size_t kWindowSize = 1024 * 1024;
+static constexpr uint64_t kPageSize = 4096;
+
+namespace {
+
+// Live mappings, looked up by the SIGBUS handler. Reading a mapped page
+// past the end of a file that was truncated underneath (logrotate
+// copytruncate, '> file') raises SIGBUS, which would kill the shell or the
+// daemon; for an address in one of these ranges the handler maps a zero
+// page there instead, so the read completes, and flags the range. The view
+// then drops the mapping and continues with pread.
+struct MappedRange {
+    atomic<bool> used{false};
+    atomic<uintptr_t> begin{0};
+    atomic<uintptr_t> end{0};
+    atomic<bool> faulted{false};
+};
+
+constexpr size_t kMaxMappedRanges = 64;
+MappedRange mappedRanges[kMaxMappedRanges];
+struct sigaction previousBusAction;
+once_flag busHandlerOnce;
+
+void onBusError(int sig, siginfo_t* info, void* context) {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(info->si_addr);
+    for (auto& range : mappedRanges) {
+        uintptr_t begin = range.begin.load(memory_order_acquire);
+        if (begin == 0 || addr < begin || addr >= range.end.load(memory_order_acquire)) {
+            continue;
+        }
+        void* page = reinterpret_cast<void*>(addr & ~static_cast<uintptr_t>(kPageSize - 1));
+        if (mmap(page, kPageSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) !=
+            MAP_FAILED) {
+            range.faulted.store(true, memory_order_release);
+            return;
+        }
+        break;
+    }
+
+    // Not one of ours: whatever was installed before
+    if ((previousBusAction.sa_flags & SA_SIGINFO) && previousBusAction.sa_sigaction) {
+        previousBusAction.sa_sigaction(sig, info, context);
+    } else if (previousBusAction.sa_handler != SIG_DFL && previousBusAction.sa_handler != SIG_IGN) {
+        previousBusAction.sa_handler(sig);
+    } else {
+        // The faulting access repeats on return and now takes the default action
+        signal(SIGBUS, SIG_DFL);
+    }
+}
+
+void installBusHandler() {
+    struct sigaction sa{};
+    sa.sa_sigaction = onBusError;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, &previousBusAction);
+}
+
+// Slot for a new mapping, or -1 when all are taken (the view uses pread)
+int claimMappedRange() {
+    call_once(busHandlerOnce, installBusHandler);
+    for (size_t i = 0; i < kMaxMappedRanges; ++i) {
+        bool expected = false;
+        if (mappedRanges[i].used.compare_exchange_strong(expected, true)) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+} // namespace
+
+#if defined(__SSE2__)
+
+size_t countNewlines(const char* p, size_t n) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    size_t count = 0;
+    size_t i = 0;
+    size_t vectorEnd = n - n % 16;
+    while (i < vectorEnd) {
+        // Per-byte counters (cmpeq yields -1 per match), summed before any
+        // of them can wrap at 255
+        __m128i acc = zero;
+        size_t end = min(vectorEnd, i + 255 * 16);
+        for (; i < end; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, newline));
+        }
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        count += static_cast<size_t>(_mm_cvtsi128_si32(sums)) +
+                 static_cast<size_t>(_mm_extract_epi16(sums, 4));
+    }
+    for (; i < n; ++i) {
+        count += p[i] == '\n';
+    }
+    return count;
+}
+
+#else
+
+size_t countNewlines(const char* p, size_t n) {
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t low7 = 0x7f7f7f7f7f7f7f7full;
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        uint64_t x = word ^ (ones * '\n');
+        // High bit set exactly in the bytes of x that are zero
+        uint64_t zeros = ~(((x & low7) + low7) | x | low7);
+        count += static_cast<size_t>(__builtin_popcountll(zeros));
+    }
+    for (; i < n; ++i) {
+        count += p[i] == '\n';
+    }
+    return count;
+}
+
+#endif
+
+FileView::FileView(const fs::path& file, bool allowMap) : path_(file), allowMap_(allowMap) {
+    openFile();
+}
+
+FileView::~FileView() {
+    unmapFile();
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+void FileView::openFile() {
+    fd_ = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        throw runtime_error(strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd_);
+        fd_ = -1;
+        throw runtime_error("not a regular file");
+    }
+    dev_ = st.st_dev;
+    ino_ = st.st_ino;
+    size_ = static_cast<uint64_t>(st.st_size);
+    mapFile();
+}
+
+void FileView::mapFile() {
+    // A 32-bit address space cannot map multi-GB files: use pread windows
+    if (!allowMap_ || sizeof(void*) < 8 || size_ == 0) {
+        return;
+    }
+    int slot = claimMappedRange();
+    if (slot < 0) {
+        return;
+    }
+    void* p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+        mappedRanges[slot].used.store(false);
+        return;
+    }
+    map_ = static_cast<char*>(p);
+    mapSize_ = size_;
+    mapSlot_ = slot;
+
+    MappedRange& range = mappedRanges[slot];
+    range.faulted.store(false);
+    range.end.store(reinterpret_cast<uintptr_t>(map_) + mapSize_, memory_order_release);
+    range.begin.store(reinterpret_cast<uintptr_t>(map_), memory_order_release);
+}
+
+void FileView::unmapFile() {
+    if (map_) {
+        MappedRange& range = mappedRanges[mapSlot_];
+        range.begin.store(0, memory_order_release);
+        range.end.store(0, memory_order_release);
+        munmap(map_, mapSize_);
+        range.used.store(false);
+        map_ = nullptr;
+        mapSize_ = 0;
+        mapSlot_ = -1;
+    }
+    windowSize_ = 0;
+}
+
+// The file was truncated under the mapping and some read got zeros: stop
+// trusting it, re-read the size and continue through pread windows
+void FileView::dropFaultedMapping() {
+    unmapFile();
+    allowMap_ = false;
+    struct stat st;
+    if (fstat(fd_, &st) == 0) {
+        size_ = static_cast<uint64_t>(st.st_size);
+    }
+    // Blocks reaching past the new end may have been counted from zeros
+    size_t fullBlocks = static_cast<size_t>(size_ / kBlockSize);
+    if (blockLines_.size() > fullBlocks + 1) {
+        blockLines_.resize(fullBlocks + 1);
+    }
+}
+
+size_t FileView::fetch(uint64_t offset, size_t len, const char*& data) {
+    if (map_ && mappedRanges[mapSlot_].faulted.load(memory_order_acquire)) {
+        dropFaultedMapping();
+    }
+    if (offset >= size_) {
+        return 0;
+    }
+    len = static_cast<size_t>(min<uint64_t>(len, size_ - offset));
+    if (map_) {
+        data = map_ + offset;
+        return len;
+    }
+
+    if (offset < windowOffset_ || offset >= windowOffset_ + windowSize_) {
+        window_.resize(kWindowSize);
+        windowOffset_ = offset - offset % kPageSize;
+        windowSize_ = 0;
+        size_t want = static_cast<size_t>(min<uint64_t>(kWindowSize, size_ - windowOffset_));
+        while (windowSize_ < want) {
+            ssize_t n = pread(fd_, window_.data() + windowSize_, want - windowSize_,
+                              static_cast<off_t>(windowOffset_ + windowSize_));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            windowSize_ += static_cast<size_t>(n);
+        }
+        if (offset >= windowOffset_ + windowSize_) {
+            return 0;  // The file shrank under us
+        }
+    }
+    data = window_.data() + (offset - windowOffset_);
+    return static_cast<size_t>(min<uint64_t>(len, windowOffset_ + windowSize_ - offset));
+}
+
+// Drop scanned pages from this process's mapping; they stay in the page
+// cache, so this only keeps the resident size bounded
+void FileView::release(uint64_t offset, size_t len) {
+    if (!map_) {
+        return;
+    }
+    uint64_t begin = (offset + kPageSize - 1) / kPageSize * kPageSize;
+    uint64_t end = (offset + len) / kPageSize * kPageSize;
+    if (end > begin) {
+        madvise(map_ + begin, static_cast<size_t>(end - begin), MADV_DONTNEED);
+    }
+}
+
+bool FileView::extendIndex() {
+    uint64_t begin = (blockLines_.size() - 1) * kBlockSize;
+    if (begin + kBlockSize > size_) {
+        return false;
+    }
+    uint64_t count = 0;
+    uint64_t pos = begin;
+    while (pos < begin + kBlockSize) {
+        const char* data;
+        size_t n = fetch(pos, static_cast<size_t>(begin + kBlockSize - pos), data);
+        if (n == 0) {
+            return false;
+        }
+        count += countNewlines(data, n);
+        pos += n;
+    }
+    release(begin, kBlockSize);
+    blockLines_.push_back(blockLines_.back() + count);
+    return true;
+}
+
+uint64_t FileView::lineOffset(uint64_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    // Line n starts after the n-th newline
+    while (blockLines_.back() < n && extendIndex()) {
+    }
+
+    uint64_t pos;
+    uint64_t remaining;
+    if (blockLines_.back() >= n) {
+        size_t b = static_cast<size_t>(lower_bound(blockLines_.begin(), blockLines_.end(), n) -
+                                       blockLines_.begin()) - 1;
+        pos = b * kBlockSize;
+        remaining = n - blockLines_[b];
+    } else {
+        pos = (blockLines_.size() - 1) * kBlockSize;  // The unindexed tail
+        remaining = n - blockLines_.back();
+    }
+
+    while (pos < size_) {
+        const char* data;
+        size_t len = fetch(pos, static_cast<size_t>(kBlockSize), data);
+        if (len == 0) {
+            break;
+        }
+        uint64_t inChunk = countNewlines(data, len);
+        if (inChunk < remaining) {
+            remaining -= inChunk;
+            pos += len;
+            continue;
+        }
+        const char* p = data;
+        for (;;) {
+            p = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(data + len - p)));
+            if (--remaining == 0) {
+                return pos + static_cast<uint64_t>(p - data) + 1;
+            }
+            ++p;
+        }
+    }
+    return size_;
+}
+
+uint64_t FileView::lineStartAt(uint64_t offset) {
+    uint64_t end = min(offset, size_);
+    while (end > 0) {
+        uint64_t begin = end > kWindowSize / 2 ? end - kWindowSize / 2 : 0;
+        const char* data;
+        size_t len = fetch(begin, static_cast<size_t>(end - begin), data);
+        if (len == 0) {
+            return 0;
+        }
+        const void* hit = memrchr(data, '\n', len);
+        if (hit) {
+            return begin + static_cast<uint64_t>(static_cast<const char*>(hit) - data) + 1;
+        }
+        end = begin;
+    }
+    return 0;
+}
+
+uint64_t FileView::linesBefore(uint64_t offset, uint64_t count) {
+    uint64_t pos = min(offset, size_);
+    for (uint64_t i = 0; i < count && pos > 0; ++i) {
+        // Skip the newline that ends the previous line
+        pos = lineStartAt(pos - 1);
+    }
+    return pos;
+}
+
+uint64_t FileView::knownLineNumber(uint64_t offset) {
+    size_t b = static_cast<size_t>(offset / kBlockSize);
+    if (b >= blockLines_.size()) {
+        return kNoLine;
+    }
+    uint64_t line = blockLines_[b];
+    uint64_t pos = b * kBlockSize;
+    while (pos < offset) {
+        const char* data;
+        size_t len = fetch(pos, static_cast<size_t>(offset - pos), data);
+        if (len == 0) {
+            break;
+        }
+        line += countNewlines(data, len);
+        pos += len;
+    }
+    return line;
+}
+
+uint64_t FileView::readLine(uint64_t offset, string& line, size_t maxLength, bool* truncated) {
+    line.clear();
+    if (truncated) *truncated = false;
+    uint64_t pos = offset;
+    while (pos < size_) {
+        const char* data;
+        size_t len = fetch(pos, static_cast<size_t>(kWindowSize), data);
+        if (len == 0) {
+            break;
+        }
+        const char* newline = static_cast<const char*>(memchr(data, '\n', len));
+        size_t take = newline ? static_cast<size_t>(newline - data) : len;
+        if (line.size() < maxLength) {
+            size_t room = maxLength - line.size();
+            line.append(data, min(take, room));
+            if (take > room && truncated) *truncated = true;
+        } else if (take > 0 && truncated) {
+            *truncated = true;
+        }
+        if (newline) {
+            return pos + take + 1;
+        }
+        pos += len;
+    }
+    return size_;
+}
+
+FileView::Change FileView::refresh() {
+    struct stat st;
+    if (stat(path_.c_str(), &st) == 0 && (st.st_dev != dev_ || st.st_ino != ino_)) {
+        unmapFile();
+        close(fd_);
+        fd_ = -1;
+        blockLines_.assign(1, 0);
+        openFile();
+        return Change::Replaced;
+    }
+
+    if (fstat(fd_, &st) != 0) {
+        return Change::None;
+    }
+    uint64_t newSize = static_cast<uint64_t>(st.st_size);
+    if (newSize == size_) {
+        return Change::None;
+    }
+
+    Change change = newSize > size_ ? Change::Grew : Change::Truncated;
+    if (change == Change::Truncated) {
+        blockLines_.assign(1, 0);
+    }
+    unmapFile();
+    size_ = newSize;
+    mapFile();
+    return change;
+}
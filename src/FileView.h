@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+using namespace std;
+
+// Newlines in [p, p + n): SSE2 on x86-64, word-at-a-time elsewhere
+size_t countNewlines(const char* p, size_t n);
+
+// Read-only random access to a text file of any size, in bounded memory.
+// The file is mapped when the address space allows it (pread windows
+// otherwise); mapped blocks are dropped again once scanned, so memory use
+// does not grow with the file. Line positions come from a sparse index
+// that stores one newline count per 1 MiB block and is only extended as
+// far as a request needs it: jumping to line N reads the file up to line N
+// once, later jumps anywhere before it cost one binary search plus a scan
+// of a single block. Byte-offset jumps and the last lines of the file never
+// touch the index. A file truncated while mapped does not crash the
+// process: a SIGBUS handler puts zero pages over the lost range and the view
+// switches to pread on its next read.
+class FileView {
+public:
+    static constexpr uint64_t kNoLine = ~uint64_t(0);
+
+    // Throws on error. Without allowMap the file is read through pread
+    // windows only, as tail -f does for a file that is expected to change.
+    explicit FileView(const filesystem::path& file, bool allowMap = true);
+    ~FileView();
+
+    FileView(const FileView&) = delete;
+    FileView& operator=(const FileView&) = delete;
+
+    uint64_t size() const { return size_; }
+    bool mapped() const { return map_ != nullptr; }
+
+    // Start of line n (0-based), or size() if the file has no such line
+    uint64_t lineOffset(uint64_t n);
+
+    // Start of the line containing offset
+    uint64_t lineStartAt(uint64_t offset);
+
+    // Start of the line `count` lines before the one starting at offset
+    uint64_t linesBefore(uint64_t offset, uint64_t count);
+
+    // 0-based number of the line starting at offset, if the index already
+    // reaches that far; kNoLine otherwise
+    uint64_t knownLineNumber(uint64_t offset);
+
+    // The line starting at offset without its newline, cut to maxLength
+    // bytes (truncated is set then). Returns the offset of the next line.
+    uint64_t readLine(uint64_t offset, string& line, size_t maxLength, bool* truncated = nullptr);
+
+    // For following a growing file
+    enum class Change { None, Grew, Truncated, Replaced };
+    // Re-check the file: picks up appended data, resets on truncation, and
+    // reopens the path if the file was replaced (log rotation)
+    Change refresh();
+
+private:
+    // Up to len bytes at offset (fewer at EOF or window edges)
+    size_t fetch(uint64_t offset, size_t len, const char*& data);
+    void release(uint64_t offset, size_t len);
+    void openFile();
+    void mapFile();
+    void unmapFile();
+    void dropFaultedMapping();
+    bool extendIndex();  // Scan one more full block; false at EOF
+
+    filesystem::path path_;
+    bool allowMap_;
+    int fd_{-1};
+    dev_t dev_{0};
+    ino_t ino_{0};
+    uint64_t size_{0};
+    char* map_{nullptr};
+    uint64_t mapSize_{0};
+    int mapSlot_{-1};  // Entry in the SIGBUS handler's table of mappings
+
+    // pread mode
+    vector<char> window_;
+    uint64_t windowOffset_{0};
+    size_t windowSize_{0};
+
+    // blockLines_[b] = newlines before block b; only full blocks are indexed
+    vector<uint64_t> blockLines_{0};
+};
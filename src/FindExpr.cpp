@@ -0,0 +1,399 @@
+#include "FindExpr.h"
+
+#include <algorithm>
+#include <fnmatch.h>
+#include <stdexcept>
+
+#include "FsUtil.h"
+
+using namespace std;
+
+namespace {
+
+using NodePtr = unique_ptr<FindNode>;
+
+// ---- Tests ----
+
+class NameTest : public FindNode {
+public:
+    NameTest(string pattern, bool ignoreCase, bool wholePath)
+        : pattern_(move(pattern)), flags_(ignoreCase ? FNM_CASEFOLD : 0), wholePath_(wholePath) {}
+
+    bool eval(fsutil::WalkEntry& entry, FindEval& state) const override {
+        if (wholePath_) {
+            string path = entry.path().string();
+            if (state.start) path = state.start->show(path);
+            return fnmatch(pattern_.c_str(), path.c_str(), flags_) == 0;
+        }
+        return fnmatch(pattern_.c_str(), entry.name(), flags_) == 0;
+    }
+    int cost() const override { return 1; }
+
+private:
+    string pattern_;
+    int flags_;
+    bool wholePath_;
+};
+
+class TypeTest : public FindNode {
+public:
+    explicit TypeTest(char type) : type_(type) {}
+
+    bool eval(fsutil::WalkEntry& entry, FindEval&) const override {
+        switch (type_) {
+            case 'd': return entry.isDirectory();
+            case 'l': return entry.isSymlink();
+            default:  return entry.isRegularFile();
+        }
+    }
+    // Answered from d_type on most filesystems
+    int cost() const override { return 1; }
+
+private:
+    char type_;
+};
+
+// find(1) numeric argument: "+N" means more than N, "-N" less than N
+struct NumericArg {
+    enum Cmp { Less, Equal, Greater } cmp{Equal};
+    uintmax_t value{0};
+
+    bool matches(uintmax_t v) const {
+        switch (cmp) {
+            case Less:    return v < value;
+            case Greater: return v > value;
+            default:      return v == value;
+        }
+    }
+};
+
+class SizeTest : public FindNode {
+public:
+    SizeTest(NumericArg arg, uintmax_t unit) : arg_(arg), unit_(unit) {}
+
+    bool eval(fsutil::WalkEntry& entry, FindEval&) const override {
+        const struct stat* st = entry.stat();
+        if (!st) return false;
+        // Like find, sizes are rounded up to whole units
+        uintmax_t units = (static_cast<uintmax_t>(st->st_size) + unit_ - 1) / unit_;
+        return arg_.matches(units);
+    }
+    int cost() const override { return 10; }
+
+private:
+    NumericArg arg_;
+    uintmax_t unit_;
+};
+
+class TimeTest : public FindNode {
+public:
+    TimeTest(NumericArg arg, bool access) : arg_(arg), access_(access) {}
+
+    bool eval(fsutil::WalkEntry& entry, FindEval& state) const override {
+        const struct stat* st = entry.stat();
+        if (!st) return false;
+        time_t t = access_ ? st->st_atime : st->st_mtime;
+        if (t > state.now) return arg_.matches(0);
+        return arg_.matches(static_cast<uintmax_t>((state.now - t) / 86400));
+    }
+    int cost() const override { return 10; }
+
+private:
+    NumericArg arg_;
+    bool access_;
+};
+
+class ConstTest : public FindNode {
+public:
+    explicit ConstTest(bool value) : value_(value) {}
+    bool eval(fsutil::WalkEntry&, FindEval&) const override { return value_; }
+    int cost() const override { return 0; }
+
+private:
+    bool value_;
+};
+
+// ---- Actions ----
+
+class PrintAction : public FindNode {
+public:
+    bool eval(fsutil::WalkEntry&, FindEval& state) const override {
+        state.printed = true;
+        return true;
+    }
+    int cost() const override { return 0; }
+    bool isAction() const override { return true; }
+};
+
+class PruneAction : public FindNode {
+public:
+    bool eval(fsutil::WalkEntry&, FindEval& state) const override {
+        state.prune = true;
+        return true;
+    }
+    int cost() const override { return 0; }
+    bool isAction() const override { return true; }
+};
+
+// ---- Operators ----
+
+class NotNode : public FindNode {
+public:
+    explicit NotNode(NodePtr child) : child_(move(child)) {}
+    bool eval(fsutil::WalkEntry& entry, FindEval& state) const override {
+        return !child_->eval(entry, state);
+    }
+    int cost() const override { return child_->cost(); }
+    bool isAction() const override { return child_->isAction(); }
+
+private:
+    NodePtr child_;
+};
+
+class ListNode : public FindNode {
+public:
+    ListNode(vector<NodePtr> children, bool isAnd)
+        : children_(move(children)), isAnd_(isAnd) {
+        // Cheapest first, but never move a test across an action: that
+        // would change which entries the action sees
+        auto begin = children_.begin();
+        while (begin != children_.end()) {
+            auto end = find_if(begin, children_.end(),
+                               [](const NodePtr& n) { return n->isAction(); });
+            stable_sort(begin, end, [](const NodePtr& a, const NodePtr& b) {
+                return a->cost() < b->cost();
+            });
+            begin = (end == children_.end()) ? end : end + 1;
+        }
+    }
+
+    bool eval(fsutil::WalkEntry& entry, FindEval& state) const override {
+        for (const auto& child : children_) {
+            if (child->eval(entry, state) != isAnd_) {
+                return !isAnd_;
+            }
+        }
+        return isAnd_;
+    }
+
+    int cost() const override {
+        int total = 0;
+        for (const auto& child : children_) total += child->cost();
+        return total;
+    }
+
+    bool isAction() const override {
+        return any_of(children_.begin(), children_.end(),
+                      [](const NodePtr& n) { return n->isAction(); });
+    }
+
+private:
+    vector<NodePtr> children_;
+    bool isAnd_;
+};
+
+// ---- Parser ----
+
+class Parser {
+public:
+    explicit Parser(const vector<string>& tokens) : tokens_(tokens) {}
+
+    NodePtr parseAll(size_t& minDepth, size_t& maxDepth) {
+        minDepth_ = &minDepth;
+        maxDepth_ = &maxDepth;
+        if (pos_ == tokens_.size()) {
+            return nullptr;
+        }
+        NodePtr node = parseOr();
+        if (pos_ != tokens_.size()) {
+            throw runtime_error("unexpected '" + tokens_[pos_] + "'");
+        }
+        return node;
+    }
+
+    bool sawAction() const { return sawAction_; }
+
+private:
+    bool atEnd() const { return pos_ >= tokens_.size(); }
+    const string& peek() const { return tokens_[pos_]; }
+
+    string takeArgument(const string& option) {
+        if (atEnd()) {
+            throw runtime_error("missing argument to " + option);
+        }
+        string arg = tokens_[pos_++];
+        // The command line is split on spaces only; allow quoted patterns
+        if (arg.size() >= 2 && (arg.front() == '\'' || arg.front() == '"') &&
+            arg.back() == arg.front()) {
+            arg = arg.substr(1, arg.size() - 2);
+        }
+        return arg;
+    }
+
+    NodePtr parseOr() {
+        vector<NodePtr> terms;
+        terms.push_back(parseAnd());
+        while (!atEnd() && (peek() == "-o" || peek() == "-or")) {
+            ++pos_;
+            terms.push_back(parseAnd());
+        }
+        if (terms.size() == 1) return move(terms[0]);
+        return make_unique<ListNode>(move(terms), false);
+    }
+
+    NodePtr parseAnd() {
+        vector<NodePtr> factors;
+        factors.push_back(parseUnary());
+        while (!atEnd() && peek() != "-o" && peek() != "-or" && peek() != ")") {
+            if (peek() == "-a" || peek() == "-and") {
+                ++pos_;
+            }
+            factors.push_back(parseUnary());
+        }
+        if (factors.size() == 1) return move(factors[0]);
+        return make_unique<ListNode>(move(factors), true);
+    }
+
+    NodePtr parseUnary() {
+        if (atEnd()) {
+            throw runtime_error("expression ends unexpectedly");
+        }
+        if (peek() == "!" || peek() == "-not") {
+            ++pos_;
+            return make_unique<NotNode>(parseUnary());
+        }
+        if (peek() == "(") {
+            ++pos_;
+            NodePtr inner = parseOr();
+            if (atEnd() || peek() != ")") {
+                throw runtime_error("missing ')'");
+            }
+            ++pos_;
+            return inner;
+        }
+        return parsePrimary();
+    }
+
+    NodePtr parsePrimary() {
+        string token = tokens_[pos_++];
+
+        if (token == "-name" || token == "-iname") {
+            return make_unique<NameTest>(takeArgument(token), token == "-iname", false);
+        }
+        if (token == "-path") {
+            return make_unique<NameTest>(takeArgument(token), false, true);
+        }
+        if (token == "-type") {
+            string type = takeArgument(token);
+            if (type != "f" && type != "d" && type != "l") {
+                throw runtime_error("unknown type '" + type + "' (use f, d or l)");
+            }
+            return make_unique<TypeTest>(type[0]);
+        }
+        if (token == "-size") {
+            string arg = takeArgument(token);
+            uintmax_t unit = 512;  // find's default unit is 512-byte blocks
+            if (!arg.empty() && !isdigit(static_cast<unsigned char>(arg.back()))) {
+                switch (arg.back()) {
+                    case 'c': unit = 1; break;
+                    case 'k': unit = 1024; break;
+                    case 'M': unit = 1024 * 1024; break;
+                    case 'G': unit = 1024ull * 1024 * 1024; break;
+                    default:
+                        throw runtime_error("unknown size unit in '" + arg + "'");
+                }
+                arg.pop_back();
+            }
+            return make_unique<SizeTest>(parseNumeric(token, arg), unit);
+        }
+        if (token == "-mtime" || token == "-atime") {
+            return make_unique<TimeTest>(parseNumeric(token, takeArgument(token)),
+                                         token == "-atime");
+        }
+        if (token == "-mindepth" || token == "-maxdepth") {
+            NumericArg n = parseNumeric(token, takeArgument(token));
+            if (n.cmp != NumericArg::Equal) {
+                throw runtime_error(token + " takes a plain number");
+            }
+            *(token == "-mindepth" ? minDepth_ : maxDepth_) = n.value;
+            return make_unique<ConstTest>(true);
+        }
+        if (token == "-true" || token == "-false") {
+            return make_unique<ConstTest>(token == "-true");
+        }
+        if (token == "-print") {
+            sawAction_ = true;
+            return make_unique<PrintAction>();
+        }
+        if (token == "-prune") {
+            return make_unique<PruneAction>();
+        }
+        throw runtime_error("unknown predicate '" + token + "'");
+    }
+
+    static NumericArg parseNumeric(const string& option, string arg) {
+        NumericArg n;
+        if (!arg.empty() && (arg[0] == '+' || arg[0] == '-')) {
+            n.cmp = arg[0] == '+' ? NumericArg::Greater : NumericArg::Less;
+            arg.erase(0, 1);
+        }
+        if (arg.empty() || !all_of(arg.begin(), arg.end(),
+                                   [](unsigned char c) { return isdigit(c); })) {
+            throw runtime_error("invalid number for " + option);
+        }
+        try {
+            n.value = stoull(arg);
+        } catch (const out_of_range&) {
+            throw runtime_error("number too large for " + option);
+        }
+        return n;
+    }
+
+    const vector<string>& tokens_;
+    size_t pos_{0};
+    bool sawAction_{false};
+    size_t* minDepth_{nullptr};
+    size_t* maxDepth_{nullptr};
+};
+
+} // namespace
+
+string FindStart::show(const string& path) const {
+    if (shown.empty() || path.compare(0, walked.size(), walked) != 0) {
+        return path;
+    }
+    string rest = path.substr(walked.size());
+    bool shownSlash = shown.back() == '/';
+    if (!rest.empty() && rest[0] == '/' && shownSlash) {
+        rest.erase(0, 1);  // "src/" was typed
+    } else if (!rest.empty() && rest[0] != '/' && !shownSlash) {
+        rest.insert(0, "/");  // walked was "/"
+    }
+    return shown + rest;
+}
+
+FindQuery FindQuery::parse(const vector<string>& tokens) {
+    FindQuery query;
+    Parser parser(tokens);
+    NodePtr expr = parser.parseAll(query.minDepth_, query.maxDepth_);
+
+    if (!expr) {
+        expr = make_unique<ConstTest>(true);
+    }
+    // As in find(1): without an explicit -print, the whole expression
+    // decides what is printed
+    if (!parser.sawAction()) {
+        vector<NodePtr> parts;
+        parts.push_back(move(expr));
+        parts.push_back(make_unique<PrintAction>());
+        expr = make_unique<ListNode>(move(parts), true);
+    }
+
+    query.root_ = move(expr);
+    return query;
+}
+
+bool FindQuery::evaluate(fsutil::WalkEntry& entry, FindEval& state) const {
+    root_->eval(entry, state);
+    return state.printed && entry.depth() >= minDepth_;
+}
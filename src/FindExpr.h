@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace fsutil {
+class WalkEntry;
+}
+
+// Where a find walk starts. As in find(1), -path sees paths that begin with
+// the start directory as the user typed it ("./src/main.cpp"), not with the
+// absolute directory that was walked.
+struct FindStart {
+    string walked;  // Absolute path the walk starts from
+    string shown;   // The same directory as given on the command line
+
+    string show(const string& path) const;
+};
+
+// Per-entry evaluation state of a find expression
+struct FindEval {
+    time_t now{0};
+    const FindStart* start{nullptr};  // -path matches absolute paths if unset
+    bool prune{false};    // Set by -prune: don't descend into this entry
+    bool printed{false};  // Set by -print: report this entry
+};
+
+class FindNode {
+public:
+    virtual ~FindNode() = default;
+    virtual bool eval(fsutil::WalkEntry& entry, FindEval& state) const = 0;
+    // Relative cost: 1 for name/d_type-only tests, 10 for tests that need stat
+    virtual int cost() const = 0;
+    // Actions (-print, -prune) have side effects and keep their position
+    virtual bool isAction() const { return false; }
+};
+
+// A compiled find-style expression, e.g.
+//   -name .git -prune -o -path */build/* -type f -size +100M -mtime +30 -print
+//
+// Tests: -name/-iname/-path GLOB, -type f|d|l, -size [+-]N[ckMG],
+// -mtime/-atime [+-]DAYS, -true, -false. Operators: ! / -not, -a / -and
+// (or juxtaposition), -o / -or, ( ). Actions: -print, -prune.
+// Options: -mindepth N, -maxdepth N. Without -print, matching entries are
+// printed as in find(1).
+//
+// After parsing, runs of side-effect-free tests under each and/or are
+// reordered cheapest first, so stat() is only called when the name and
+// type tests have not already decided the outcome.
+class FindQuery {
+public:
+    // Throws runtime_error with a user-facing message on bad input
+    static FindQuery parse(const vector<string>& tokens);
+
+    size_t minDepth() const { return minDepth_; }
+    size_t maxDepth() const { return maxDepth_; }
+
+    // Returns whether the entry should be reported; state.prune tells the
+    // walker to skip the entry's subtree
+    bool evaluate(fsutil::WalkEntry& entry, FindEval& state) const;
+
+private:
+    shared_ptr<const FindNode> root_;
+    size_t minDepth_{0};
+    size_t maxDepth_{static_cast<size_t>(-1)};
+};
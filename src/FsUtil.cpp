@@ -5,11 +5,25 @@
 #include <fstream>
 #include <algorithm>
 #include <cctype>
+#include <functional>
 #include <sys/stat.h>    // For stat()
-#include <sys/syscall.h> // For syscall()
 #include <linux/stat.h>  // For statx() and STATX_BTIME
 #include <fcntl.h>       // For AT_FDCWD
-#include <unistd.h>      // For syscall()
+#include <unistd.h>      // For close()
+#include <dirent.h>      // For fdopendir()/readdir()
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <atomic>
+#include <array>
+#include <condition_variable>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+#include <iterator>
+
+#include "AllocStats.h"
+#include "Parallel.h"
 
 using namespace std;
 
@@ -39,9 +53,10 @@ static FileTimestamps getTimestamps(const fs::path& p) {
     // Use statx() to get birth time (creation time) - available on Linux 4.11+
     struct statx stxbuf;
     
-    // Call statx via syscall for better compatibility
-    int ret = syscall(SYS_statx, AT_FDCWD, p.c_str(), 0, 
-                      STATX_BASIC_STATS | STATX_BTIME, &stxbuf);
+    // The glibc wrapper (2.28+) rather than syscall(SYS_statx, ...), so
+    // interposers such as tools/SlowFs.cpp see the call
+    int ret = statx(AT_FDCWD, p.c_str(), 0,
+                    STATX_BASIC_STATS | STATX_BTIME, &stxbuf);
     
     if (ret == 0) {
         ts.mtime = stxbuf.stx_mtime.tv_sec;  // Last modification time
@@ -78,6 +93,37 @@ static bool containsIgnoreCase(const string& str, const string& keyword) {
     return strLower.find(keyLower) != string::npos;
 }
 
+// Depth-first walk below root with an explicit stack, so directories can be
+// counted for progress/ETA and the walk can stop between entries.
+// Unreadable subdirectories are skipped; symlinked directories are not followed.
+static void walkTree(const fs::path& root, OpControl* ctl,
+                     const function<void(const fs::directory_entry&)>& visit) {
+    vector<fs::path> pending{root};
+    if (ctl) ctl->dirDiscovered();
+
+    while (!pending.empty()) {
+        fs::path dir = move(pending.back());
+        pending.pop_back();
+
+        error_code ec;
+        fs::directory_iterator it(dir, ec);
+        if (ec && dir == root) {
+            throw fs::filesystem_error("cannot open directory", dir, ec);
+        }
+        for (; !ec && it != fs::directory_iterator(); it.increment(ec)) {
+            if (ctl) ctl->checkCancelled();
+            const auto& entry = *it;
+            visit(entry);
+            if (entry.is_directory(ec) && !entry.is_symlink(ec)) {
+                pending.push_back(entry.path());
+                if (ctl) ctl->dirDiscovered();
+            }
+            ec.clear();
+        }
+        if (ctl) ctl->dirDone();
+    }
+}
+
 bool existsDir(const fs::path& p) {
     return fs::exists(p) && fs::is_directory(p);
 }
@@ -90,7 +136,8 @@ bool isDirectory(const fs::path& p) {
     return fs::is_directory(p);
 }
 
-fs::path normalizePath(const fs::path& base, const string& userInputPath) {
+fs::path normalizePath(const fs::path& base, const string& userInputPath,
+                       const fs::path& home) {
     // Handle empty input - return base
     if (userInputPath.empty()) {
         return base;
@@ -98,9 +145,8 @@ fs::path normalizePath(const fs::path& base, const string& userInputPath) {
 
     // Handle ~ for home directory
     if (userInputPath[0] == '~') {
-        const char* home = getenv("HOME");
-        if (home) {
-            string expanded = home;
+        if (!home.empty()) {
+            string expanded = home.string();
             if (userInputPath.size() > 1) {
                 expanded += userInputPath.substr(1);
             }
@@ -115,15 +161,22 @@ fs::path normalizePath(const fs::path& base, const string& userInputPath) {
     return fs::weakly_canonical(p);
 }
 
-vector<FileInfo> listDirectory(const fs::path& dir) {
+vector<FileInfo> listDirectory(const fs::path& dir, OpControl* ctl) {
     vector<FileInfo> result;
+    listDirectory(dir, ctl, [&](const FileInfo& info) { result.push_back(info); });
+    return result;
+}
 
+void listDirectory(const fs::path& dir, OpControl* ctl,
+                   const function<void(const FileInfo&)>& visit) {
     if (!fs::exists(dir) || !fs::is_directory(dir)) {
-        return result;
+        return;
     }
 
+    FileInfo info;
     for (const auto& entry : fs::directory_iterator(dir)) {
-        FileInfo info;
+        if (ctl) ctl->checkCancelled();
+
         info.name = entry.path().filename().string();
         info.path = entry.path();
         info.isDirectory = entry.is_directory();
@@ -141,13 +194,12 @@ vector<FileInfo> listDirectory(const fs::path& dir) {
         info.atime = ts.atime;
         info.ctime = ts.ctime;
 
-        result.push_back(info);
+        if (ctl) ctl->addEntry(info.size);
+        visit(info);
     }
-
-    return result;
 }
 
-FileInfo getFileInfo(const fs::path& p, bool calcDirSize) {
+FileInfo getFileInfo(const fs::path& p, bool calcDirSize, OpControl* ctl) {
     FileInfo info;
     info.name = p.filename().string();
     info.path = p;
@@ -161,7 +213,7 @@ FileInfo getFileInfo(const fs::path& p, bool calcDirSize) {
     // Get size
     if (info.isDirectory) {
         if (calcDirSize) {
-            info.size = calcDirectorySize(p);
+            info.size = calcDirectorySize(p, ctl);
         } else {
             info.size = 0;  // Will display as "-"
         }
@@ -214,16 +266,26 @@ bool removeEmptyDir(const fs::path& dir) {
 
 vector<FileInfo> searchRecursive(
     const fs::path& start,
-    const string& keyword
+    const string& keyword,
+    OpControl* ctl
 ) {
     vector<FileInfo> result;
+    searchRecursive(start, keyword, ctl, [&](const FileInfo& info) { result.push_back(info); });
+    return result;
+}
 
+void searchRecursive(
+    const fs::path& start,
+    const string& keyword,
+    OpControl* ctl,
+    const function<void(const FileInfo&)>& visit
+) {
     if (!fs::exists(start) || !fs::is_directory(start)) {
-        return result;
+        return;
     }
 
-    // Use recursive_directory_iterator to traverse all subdirectories
-    for (const auto& entry : fs::recursive_directory_iterator(start)) {
+    walkTree(start, ctl, [&](const fs::directory_entry& entry) {
+        if (ctl) ctl->addEntry();
         string filename = entry.path().filename().string();
 
         // Case-insensitive search
@@ -245,28 +307,509 @@ vector<FileInfo> searchRecursive(
             info.atime = ts.atime;
             info.ctime = ts.ctime;
 
-            result.push_back(info);
+            visit(info);
         }
+    });
+}
+
+vector<FileInfo> findRecursive(
+    const fs::path& start,
+    const FindQuery& query,
+    OpControl* ctl,
+    const string& shownStart
+) {
+    if (!fs::exists(start) || !fs::is_directory(start)) {
+        return {};
+    }
+
+    fs::path root = start;
+    if (!root.has_filename() && root.has_relative_path()) {
+        root = root.parent_path();  // Trailing slash
     }
+    FindStart where{root.string(), shownStart};
 
+    WalkOptions options;
+    options.ctl = ctl;
+    vector<vector<FileInfo>> perWorker(options.workers);
+    time_t now = time(nullptr);
+
+    auto visit = [&](WalkEntry& entry) {
+        if (ctl) ctl->addEntry();
+
+        FindEval state;
+        state.now = now;
+        state.start = &where;
+        if (query.evaluate(entry, state)) {
+            FileInfo info;
+            info.name = entry.name();
+            info.path = entry.path();
+            info.isDirectory = entry.isDirectory();
+            perWorker[entry.worker()].push_back(move(info));
+        }
+        return !state.prune && entry.depth() < query.maxDepth();
+    };
+
+    // Like find(1), the start directory is an entry too (at depth 0), so
+    // -type d or -name can report it and -prune can stop the walk
+    bool descend;
+    if (root.has_filename()) {
+        fs::path parent = root.parent_path();
+        string name = root.filename().string();
+        int parentFd = open(parent.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        WalkEntry entry(parent, name.c_str(), DT_DIR, parentFd, 0, 0, nullptr);
+        descend = visit(entry);
+        if (parentFd >= 0) close(parentFd);
+    } else {
+        // "/": empty parent, so path() is the root itself
+        fs::path parent;
+        WalkEntry entry(parent, "/", DT_DIR, AT_FDCWD, 0, 0, nullptr);
+        descend = visit(entry);
+    }
+    if (descend) {
+        walkParallel(root, options, visit);
+    }
+
+    vector<FileInfo> result;
+    for (auto& part : perWorker) {
+        move(part.begin(), part.end(), back_inserter(result));
+    }
+    sort(result.begin(), result.end(),
+         [](const FileInfo& a, const FileInfo& b) { return a.path < b.path; });
     return result;
 }
 
-uintmax_t calcDirectorySize(const fs::path& dir) {
-    uintmax_t totalSize = 0;
+RemovalPlan planTreeRemoval(const fs::path& root, OpControl* ctl) {
+    RemovalPlan plan;
+    plan.root = root;
+    plan.dirsByDepth.push_back({root});
+    plan.dirCount = 1;
+
+    walkTree(root, ctl, [&](const fs::directory_entry& entry) {
+        error_code ec;
+        if (entry.is_directory(ec) && !entry.is_symlink(ec)) {
+            size_t depth = 0;
+            for (const auto& part : entry.path().lexically_relative(root)) {
+                (void)part;
+                ++depth;
+            }
+            if (plan.dirsByDepth.size() <= depth) {
+                plan.dirsByDepth.resize(depth + 1);
+            }
+            plan.dirsByDepth[depth].push_back(entry.path());
+            ++plan.dirCount;
+            if (ctl) ctl->addEntry();
+            return;
+        }
+
+        uintmax_t size = 0;
+        if (entry.is_regular_file(ec) && !entry.is_symlink(ec)) {
+            size = entry.file_size(ec);
+            if (ec) size = 0;
+        }
+        ++plan.fileCount;
+        plan.totalBytes += size;
+        if (ctl) ctl->addEntry(size);
+    });
+
+    return plan;
+}
+
+namespace {
+
+struct DirCloser {
+    void operator()(DIR* d) const { closedir(d); }
+};
+
+} // namespace
+
+// Cap on stored messages; a tree with a million read-only files would
+// otherwise build a million strings
+static constexpr size_t kMaxRemovalErrors = 100;
+
+RemovalResult removeTree(const RemovalPlan& plan, unsigned workers, OpControl* ctl) {
+    RemovalResult result;
+    atomic<uintmax_t> filesRemoved{0};
+    atomic<uintmax_t> dirsRemoved{0};
+    mutex errorMutex;
+
+    auto recordError = [&](const string& what, const string& path, int err) {
+        lock_guard<mutex> lock(errorMutex);
+        ++result.errorCount;
+        if (result.errors.size() < kMaxRemovalErrors) {
+            result.errors.push_back(what + " " + path + ": " + strerror(err));
+        }
+    };
+
+    if (ctl) ctl->dirDiscovered(plan.dirCount);
+
+    // Empty out one directory: unlink its files and its (already emptied)
+    // subdirectories, all relative to the directory fd
+    auto clearDir = [&](const fs::path& dir) {
+        int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            recordError("Cannot open", dir.string(), errno);
+            return;
+        }
+        // Closed on every exit, including a cancel thrown from the loop
+        unique_ptr<DIR, DirCloser> d(fdopendir(fd));
+        if (!d) {
+            recordError("Cannot open", dir.string(), errno);
+            close(fd);
+            return;
+        }
+
+        while (struct dirent* de = readdir(d.get())) {
+            if (ctl) ctl->checkCancelled();
+            const char* name = de->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                continue;
+            }
+
+            bool isDir = de->d_type == DT_DIR;
+            if (de->d_type == DT_UNKNOWN) {
+                struct stat st;
+                isDir = fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
 
+            if (unlinkat(fd, name, isDir ? AT_REMOVEDIR : 0) == 0) {
+                if (isDir) {
+                    ++dirsRemoved;
+                } else {
+                    ++filesRemoved;
+                }
+                if (ctl) ctl->addEntry();
+            } else {
+                recordError("Cannot remove", (dir / name).string(), errno);
+            }
+        }
+        d.reset();  // Also closes fd
+        if (ctl) ctl->dirDone();
+    };
+
+    // A level can only be emptied once every level below it is gone, so the
+    // levels are processed in sequence with the directories of one level in
+    // parallel
+    for (size_t depth = plan.dirsByDepth.size(); depth-- > 0;) {
+        const auto& dirs = plan.dirsByDepth[depth];
+        parallelFor(dirs.size(), workers, [&](size_t i, unsigned) {
+            clearDir(dirs[i]);
+        });
+    }
+
+    if (rmdir(plan.root.c_str()) == 0) {
+        ++dirsRemoved;
+    } else {
+        recordError("Cannot remove", plan.root.string(), errno);
+    }
+
+    result.filesRemoved = filesRemoved.load();
+    result.dirsRemoved = dirsRemoved.load();
+    return result;
+}
+
+uintmax_t calcDirectorySize(const fs::path& dir, OpControl* ctl) {
     if (!fs::exists(dir) || !fs::is_directory(dir)) {
         return 0;
     }
 
-    // Sum file sizes recursively
-    for (const auto& entry : fs::recursive_directory_iterator(dir)) {
-        if (entry.is_regular_file()) {
-            totalSize += entry.file_size();
+    return calcDiskUsage(dir, false, ctl).apparentBytes;
+}
+
+bool WalkEntry::isDirectory() {
+    if (dtype_ != DT_UNKNOWN) {
+        return dtype_ == DT_DIR;
+    }
+    const struct stat* st = stat();
+    return st && S_ISDIR(st->st_mode);
+}
+
+bool WalkEntry::isSymlink() {
+    if (dtype_ != DT_UNKNOWN) {
+        return dtype_ == DT_LNK;
+    }
+    const struct stat* st = stat();
+    return st && S_ISLNK(st->st_mode);
+}
+
+bool WalkEntry::isRegularFile() {
+    if (dtype_ != DT_UNKNOWN) {
+        return dtype_ == DT_REG;
+    }
+    const struct stat* st = stat();
+    return st && S_ISREG(st->st_mode);
+}
+
+const struct stat* WalkEntry::stat() {
+    if (!statDone_) {
+        statDone_ = true;
+        statOk_ = fstatat(dirFd_, name_, &st_, AT_SYMLINK_NOFOLLOW) == 0;
+    }
+    return statOk_ ? &st_ : nullptr;
+}
+
+namespace {
+
+// Shared LIFO stack of directories still to read. LIFO keeps the stack
+// small on wide trees and gives each thread some locality.
+class ParallelWalk {
+public:
+    ParallelWalk(const WalkOptions& options, const WalkVisitor& visit)
+        : options_(options), visit_(visit), account_(boundAllocAccount) {}
+
+    void run(const fs::path& root) {
+        struct stat rootSt;
+        if (::stat(root.c_str(), &rootSt) != 0) {
+            throw fs::filesystem_error("cannot open directory", root,
+                                       error_code(errno, generic_category()));
+        }
+        rootDev_ = rootSt.st_dev;
+
+        pending_.push_back(Task{root, 0, options_.rootTag});
+        if (options_.ctl) options_.ctl->dirDiscovered();
+
+        workerLoop(0);
+
+        // After a cancel or error worker 0 returns while others may still be
+        // reading; once none is active nothing can spawn threads any more
+        vector<thread> threads;
+        {
+            unique_lock<mutex> lock(mutex_);
+            cv_.wait(lock, [&] { return active_ == 0; });
+            threads = move(threads_);
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        if (error_) {
+            rethrow_exception(error_);
+        }
+    }
+
+private:
+    struct Task {
+        fs::path dir;
+        size_t depth;
+        void* tag;
+    };
+
+    void workerLoop(unsigned worker) {
+        // Spawned workers charge allocations to the caller's command
+        AllocAccountBinding binding(account_);
+        vector<Task> found;
+        for (;;) {
+            Task task;
+            {
+                unique_lock<mutex> lock(mutex_);
+                cv_.wait(lock, [&] { return stop_ || !pending_.empty() || active_ == 0; });
+                if (stop_ || pending_.empty()) {
+                    cv_.notify_all();
+                    return;
+                }
+                task = move(pending_.back());
+                pending_.pop_back();
+                ++active_;
+            }
+
+            try {
+                readDir(task, worker, found);
+            } catch (...) {
+                lock_guard<mutex> lock(mutex_);
+                if (!error_) error_ = current_exception();
+                stop_ = true;
+                --active_;
+                cv_.notify_all();
+                return;
+            }
+
+            {
+                lock_guard<mutex> lock(mutex_);
+                for (auto& t : found) {
+                    pending_.push_back(move(t));
+                }
+                found.clear();
+                --active_;
+                // Grow the pool only when there is work to share
+                while (!stop_ && pending_.size() > 1 && threads_.size() + 1 < options_.workers) {
+                    unsigned id = static_cast<unsigned>(threads_.size()) + 1;
+                    threads_.emplace_back(&ParallelWalk::workerLoop, this, id);
+                }
+            }
+            cv_.notify_all();
+        }
+    }
+
+    void readDir(const Task& task, unsigned worker, vector<Task>& found) {
+        OpControl* ctl = options_.ctl;
+
+        int fd = open(task.dir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            if (task.depth == 0) {
+                throw fs::filesystem_error("cannot open directory", task.dir,
+                                           error_code(errno, generic_category()));
+            }
+            return;
+        }
+        unique_ptr<DIR, DirCloser> dir(fdopendir(fd));
+        if (!dir) {
+            close(fd);
+            return;
         }
+
+        while (struct dirent* de = readdir(dir.get())) {
+            if (ctl) ctl->checkCancelled();
+            const char* name = de->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                continue;
+            }
+
+            WalkEntry entry(task.dir, name, de->d_type, fd, task.depth + 1, worker, task.tag);
+            if (!visit_(entry) || !entry.isDirectory()) {
+                continue;
+            }
+            if (options_.oneFileSystem) {
+                const struct stat* st = entry.stat();
+                if (!st || st->st_dev != rootDev_) {
+                    continue;
+                }
+            }
+            found.push_back(Task{task.dir / name, task.depth + 1, entry.childTag()});
+            if (ctl) ctl->dirDiscovered();
+        }
+
+        if (ctl) ctl->dirDone();
+    }
+
+    const WalkOptions& options_;
+    const WalkVisitor& visit_;
+    AllocAccount* account_;
+    dev_t rootDev_{0};
+
+    mutex mutex_;
+    condition_variable cv_;
+    vector<Task> pending_;
+    unsigned active_{0};
+    bool stop_{false};
+    exception_ptr error_;
+    vector<thread> threads_;
+};
+
+// (dev, ino) pairs of multiply-linked files already counted. Only files
+// with nlink > 1 go in, so on typical trees this stays tiny. Sharded so the
+// walker threads rarely contend.
+class HardlinkSet {
+public:
+    // Returns false if the inode was already seen
+    bool insert(dev_t dev, ino_t ino) {
+        Key key{static_cast<uint64_t>(dev), static_cast<uint64_t>(ino)};
+        Shard& shard = shards_[KeyHash()(key) % kShards];
+        lock_guard<mutex> lock(shard.guard);
+        return shard.seen.insert(key).second;
+    }
+
+private:
+    struct Key {
+        uint64_t dev;
+        uint64_t ino;
+        bool operator==(const Key& o) const { return dev == o.dev && ino == o.ino; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            return static_cast<size_t>((k.ino * 0x9E3779B97F4A7C15ull) ^ k.dev);
+        }
+    };
+    struct Shard {
+        mutex guard;
+        unordered_set<Key, KeyHash> seen;
+    };
+
+    static constexpr size_t kShards = 64;
+    array<Shard, kShards> shards_;
+};
+
+} // namespace
+
+void walkParallel(const fs::path& root, const WalkOptions& options,
+                  const WalkVisitor& visit) {
+    ParallelWalk walk(options, visit);
+    walk.run(root);
+}
+
+DiskUsage calcDiskUsage(const fs::path& dir, bool oneFileSystem, OpControl* ctl,
+                        DuTree* tree) {
+    WalkOptions options;
+    options.oneFileSystem = oneFileSystem;
+    options.ctl = ctl;
+    if (tree) {
+        options.workers = min(options.workers, tree->slotCount());
+        options.rootTag = tree->root();
     }
 
-    return totalSize;
+    // Per-thread totals, padded so the threads don't share cache lines
+    struct alignas(64) Slot {
+        DiskUsage usage;
+    };
+    vector<Slot> slots(options.workers);
+    HardlinkSet hardlinks;
+
+    walkParallel(dir, options, [&](WalkEntry& entry) {
+        const struct stat* st = entry.stat();
+        if (!st) {
+            return false;
+        }
+
+        DiskUsage& usage = slots[entry.worker()].usage;
+        uintmax_t allocated = static_cast<uintmax_t>(st->st_blocks) * 512;
+        // The whole directory is read by this thread, so its node needs no lock
+        DuNode* parentNode = static_cast<DuNode*>(entry.parentTag());
+
+        if (S_ISDIR(st->st_mode)) {
+            ++usage.dirs;
+            usage.allocatedBytes += allocated;
+            if (tree) {
+                DuNode* node = tree->addNode(entry.worker(), parentNode, entry.name());
+                node->ownAllocated = allocated;
+                entry.setChildTag(node);
+            }
+            if (ctl) ctl->addEntry();
+            return true;
+        }
+
+        if (st->st_nlink > 1 && !hardlinks.insert(st->st_dev, st->st_ino)) {
+            ++usage.hardlinksSkipped;
+            return false;
+        }
+
+        uintmax_t apparent = S_ISREG(st->st_mode) ? static_cast<uintmax_t>(st->st_size) : 0;
+        ++usage.files;
+        usage.apparentBytes += apparent;
+        usage.allocatedBytes += allocated;
+        if (parentNode) {
+            parentNode->ownApparent += apparent;
+            parentNode->ownAllocated += allocated;
+        }
+        if (ctl) ctl->addEntry(apparent);
+        return false;
+    });
+
+    DiskUsage total;
+    struct stat rootSt;
+    if (lstat(dir.c_str(), &rootSt) == 0) {
+        total.allocatedBytes = static_cast<uintmax_t>(rootSt.st_blocks) * 512;
+        if (tree) {
+            tree->root()->ownAllocated += total.allocatedBytes;
+        }
+    }
+    for (const auto& slot : slots) {
+        total.apparentBytes += slot.usage.apparentBytes;
+        total.allocatedBytes += slot.usage.allocatedBytes;
+        total.files += slot.usage.files;
+        total.dirs += slot.usage.dirs;
+        total.hardlinksSkipped += slot.usage.hardlinksSkipped;
+    }
+    if (tree) {
+        tree->finalize();
+    }
+    return total;
 }
 
 void copyFile(const fs::path& src,
@@ -1,10 +1,17 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
 #include <string>
 #include <vector>
 
+#include <sys/stat.h>
+
+#include "DuTree.h"
 #include "FileInfo.h"
+#include "FindExpr.h"
+#include "OpControl.h"
+#include "Parallel.h"
 
 using namespace std;
 
@@ -14,14 +21,25 @@ bool existsDir(const filesystem::path& p);
 bool existsFile(const filesystem::path& p);
 bool isDirectory(const filesystem::path& p);
 
+// Resolve user input against base; a leading ~ expands to home
 filesystem::path normalizePath(
     const filesystem::path& base,
-    const string& userInputPath
+    const string& userInputPath,
+    const filesystem::path& home
 );
 
-vector<FileInfo> listDirectory(const filesystem::path& dir);
+// Long-running operations take an optional OpControl: they report progress
+// to it and throw OperationCancelled once it is cancelled.
+
+vector<FileInfo> listDirectory(const filesystem::path& dir,
+                               OpControl* ctl = nullptr);
+// Streaming form: entries are handed to visit one at a time and never
+// collected, for directories too large to hold in memory
+void listDirectory(const filesystem::path& dir, OpControl* ctl,
+                   const function<void(const FileInfo&)>& visit);
 
-FileInfo getFileInfo(const filesystem::path& p, bool calcDirSize = false);
+FileInfo getFileInfo(const filesystem::path& p, bool calcDirSize = false,
+                     OpControl* ctl = nullptr);
 
 void createFile(const filesystem::path& file);
 void createDir(const filesystem::path& dir);
@@ -30,10 +48,134 @@ bool removeEmptyDir(const filesystem::path& dir);
 
 vector<FileInfo> searchRecursive(
     const filesystem::path& start,
-    const string& keyword
+    const string& keyword,
+    OpControl* ctl = nullptr
+);
+void searchRecursive(
+    const filesystem::path& start,
+    const string& keyword,
+    OpControl* ctl,
+    const function<void(const FileInfo&)>& visit
+);
+
+// Entries matching a find expression, start itself included, sorted by
+// path. Walks in parallel and prunes whole subtrees (-prune, -maxdepth)
+// without reading them. Only name, path and isDirectory are filled in: the
+// query decides whether an entry is ever stat'ed. -path matches paths that
+// begin with shownStart (start as the user typed it) when it is given.
+vector<FileInfo> findRecursive(
+    const filesystem::path& start,
+    const FindQuery& query,
+    OpControl* ctl = nullptr,
+    const string& shownStart = ""
 );
 
-uintmax_t calcDirectorySize(const filesystem::path& dir);
+// Pre-walk of a tree that is about to be deleted with removeTree()
+struct RemovalPlan {
+    filesystem::path root;
+    vector<vector<filesystem::path>> dirsByDepth;  // [0] holds root itself
+    uintmax_t fileCount{0};  // Everything that is not a directory
+    uintmax_t dirCount{0};   // Including root
+    uintmax_t totalBytes{0};
+};
+
+struct RemovalResult {
+    uintmax_t filesRemoved{0};
+    uintmax_t dirsRemoved{0};
+    uintmax_t errorCount{0};
+    vector<string> errors;  // The first few messages only
+};
+
+RemovalPlan planTreeRemoval(const filesystem::path& root,
+                            OpControl* ctl = nullptr);
+
+// Delete everything in plan, deepest level first, with `workers` threads
+// unlinking relative to directory fds. Failures are collected, not thrown.
+RemovalResult removeTree(const RemovalPlan& plan, unsigned workers,
+                         OpControl* ctl = nullptr);
+
+uintmax_t calcDirectorySize(const filesystem::path& dir,
+                            OpControl* ctl = nullptr);
+
+// ---- Parallel tree walker ----
+
+// One directory entry as seen by walkParallel(). Only the name and d_type
+// come from readdir; stat() is done on first use, relative to the parent's fd.
+class WalkEntry {
+public:
+    WalkEntry(const filesystem::path& parent, const char* name, unsigned char dtype,
+              int dirFd, size_t depth, unsigned worker, void* parentTag)
+        : parent_(parent), name_(name), dtype_(dtype), dirFd_(dirFd),
+          depth_(depth), worker_(worker), parentTag_(parentTag) {}
+
+    const filesystem::path& parent() const { return parent_; }
+    const char* name() const { return name_; }
+    filesystem::path path() const { return parent_ / name_; }
+    // Depth below the walk root: its direct children are at depth 1
+    size_t depth() const { return depth_; }
+    // Index of the walker thread running the visitor, for per-thread state
+    unsigned worker() const { return worker_; }
+
+    // Opaque per-directory value for visitors that build their own tree:
+    // the tag set on a directory entry is handed to all of its children
+    void* parentTag() const { return parentTag_; }
+    void setChildTag(void* tag) { childTag_ = tag; }
+    void* childTag() const { return childTag_; }
+
+    bool isDirectory();  // Never true for a symlink
+    bool isSymlink();
+    bool isRegularFile();
+
+    // lstat()-style data, or nullptr if the entry vanished or is unreadable
+    const struct stat* stat();
+
+private:
+    const filesystem::path& parent_;
+    const char* name_;
+    unsigned char dtype_;
+    int dirFd_;
+    size_t depth_;
+    unsigned worker_;
+    void* parentTag_;
+    void* childTag_{nullptr};
+    bool statDone_{false};
+    bool statOk_{false};
+    struct stat st_{};
+};
+
+struct WalkOptions {
+    unsigned workers{defaultWorkerCount()};  // WalkEntry::worker() < workers
+    bool oneFileSystem{false};               // Don't descend into other mounts
+    void* rootTag{nullptr};                  // parentTag() of root's children
+    OpControl* ctl{nullptr};
+};
+
+// Called concurrently from the walker threads for every entry below root.
+// Return false to skip descending into a directory (ignored otherwise).
+using WalkVisitor = function<bool(WalkEntry& entry)>;
+
+// Walk the tree below root with several threads. Directories are opened once
+// and read with readdir; symlinks are never followed. Unreadable
+// subdirectories are skipped; an unreadable root throws. Threads beyond the
+// calling one are only started once there is more than one directory queued.
+void walkParallel(const filesystem::path& root, const WalkOptions& options,
+                      const WalkVisitor& visit);
+
+// ---- Disk usage ----
+
+struct DiskUsage {
+    uintmax_t apparentBytes{0};   // Sum of regular file sizes
+    uintmax_t allocatedBytes{0};  // st_blocks of every entry, directories included
+    uintmax_t files{0};
+    uintmax_t dirs{0};
+    uintmax_t hardlinksSkipped{0};  // Extra links to an inode already counted
+};
+
+// Like du: each inode with several hard links is counted once, and the
+// allocated size reflects holes in sparse files. If tree is given (rooted at
+// dir), it receives per-directory sizes from the same walk and is finalized.
+DiskUsage calcDiskUsage(const filesystem::path& dir, bool oneFileSystem = false,
+                        OpControl* ctl = nullptr, DuTree* tree = nullptr);
 
 void copyFile(const filesystem::path& src,
               const filesystem::path& dst,
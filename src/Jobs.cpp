@@ -0,0 +1,205 @@
+#include "Jobs.h"
+
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+#include "FileSystemContext.h"
+
+using namespace std;
+
+// Finished jobs kept (output included) for 'fg' after their notice was
+// printed; older ones are dropped so a long session does not grow forever
+static constexpr size_t kMaxFinishedJobs = 10;
+
+struct Job {
+    int id{0};
+    string commandLine;
+    JobOutputBuffer buffer;
+    ostream out{&buffer};
+    istringstream in;  // Background jobs never read the terminal: prompts see EOF
+    FileSystemContext ctx;
+    JobState state{JobState::Running};  // Guarded by JobTable::mutex_
+    bool reported{false};
+    thread worker;
+};
+
+const char* jobStateName(JobState state) {
+    switch (state) {
+        case JobState::Running: return "Running";
+        case JobState::Done:    return "Done";
+        case JobState::Killed:  return "Killed";
+        case JobState::Failed:  return "Failed";
+    }
+    return "?";
+}
+
+string JobOutputBuffer::drain() {
+    lock_guard<mutex> lock(mutex_);
+    string result;
+    result.swap(data_);
+    return result;
+}
+
+JobOutputBuffer::int_type JobOutputBuffer::overflow(int_type ch) {
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        lock_guard<mutex> lock(mutex_);
+        data_.push_back(traits_type::to_char_type(ch));
+    }
+    return traits_type::not_eof(ch);
+}
+
+streamsize JobOutputBuffer::xsputn(const char* s, streamsize n) {
+    lock_guard<mutex> lock(mutex_);
+    data_.append(s, static_cast<size_t>(n));
+    return n;
+}
+
+JobTable::~JobTable() {
+    vector<shared_ptr<Job>> jobs;
+    {
+        lock_guard<mutex> lock(mutex_);
+        jobs = jobs_;
+        for (auto& job : jobs) {
+            job->ctx.op->cancel();
+        }
+    }
+    for (auto& job : jobs) {
+        if (job->worker.joinable()) {
+            job->worker.join();
+        }
+    }
+}
+
+int JobTable::launch(const string& commandLine, const FileSystemContext& ctx, Body body) {
+    auto job = make_shared<Job>();
+    job->commandLine = commandLine;
+    job->ctx = ctx;
+    job->ctx.out = &job->out;
+    job->ctx.in = &job->in;
+    job->ctx.jobs = nullptr;  // Jobs cannot manage other jobs
+    job->ctx.op = make_shared<OpControl>();
+    job->ctx.op->begin(commandLine);
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        job->id = nextId_++;
+        jobs_.push_back(job);
+    }
+
+    job->worker = thread([this, job, body] {
+        JobState finalState = JobState::Done;
+        try {
+            body(job->ctx);
+        } catch (const OperationCancelled&) {
+            job->out << "Interrupted: " << job->commandLine << "\n";
+            finalState = JobState::Killed;
+        } catch (const exception& e) {
+            job->out << "Error: " << e.what() << "\n";
+            finalState = JobState::Failed;
+        }
+        {
+            lock_guard<mutex> lock(mutex_);
+            job->state = finalState;
+        }
+        changed_.notify_all();
+    });
+
+    return job->id;
+}
+
+vector<JobSummary> JobTable::list() const {
+    lock_guard<mutex> lock(mutex_);
+    vector<JobSummary> result;
+    for (const auto& job : jobs_) {
+        result.push_back(JobSummary{job->id, job->commandLine, job->state});
+    }
+    return result;
+}
+
+shared_ptr<Job> JobTable::findLocked(int id) const {
+    for (const auto& job : jobs_) {
+        if (job->id == id) return job;
+    }
+    return nullptr;
+}
+
+bool JobTable::foreground(int id, ostream& out, const function<bool()>& interrupted) {
+    shared_ptr<Job> job;
+    {
+        lock_guard<mutex> lock(mutex_);
+        job = findLocked(id);
+    }
+    if (!job) {
+        return false;
+    }
+
+    bool killRequested = false;
+    for (;;) {
+        out << job->buffer.drain() << flush;
+
+        unique_lock<mutex> lock(mutex_);
+        if (job->state != JobState::Running) {
+            break;
+        }
+        if (!killRequested && interrupted()) {
+            job->ctx.op->cancel();
+            killRequested = true;
+        }
+        changed_.wait_for(lock, chrono::milliseconds(100));
+    }
+
+    if (job->worker.joinable()) {
+        job->worker.join();
+    }
+    out << job->buffer.drain() << flush;
+
+    lock_guard<mutex> lock(mutex_);
+    for (auto it = jobs_.begin(); it != jobs_.end(); ++it) {
+        if (*it == job) {
+            jobs_.erase(it);
+            break;
+        }
+    }
+    return true;
+}
+
+bool JobTable::kill(int id) {
+    lock_guard<mutex> lock(mutex_);
+    shared_ptr<Job> job = findLocked(id);
+    if (!job || job->state != JobState::Running) {
+        return false;
+    }
+    job->ctx.op->cancel();
+    return true;
+}
+
+void JobTable::reportFinished(ostream& out) {
+    lock_guard<mutex> lock(mutex_);
+    for (auto& job : jobs_) {
+        if (job->state != JobState::Running && !job->reported) {
+            out << "[" << job->id << "] " << jobStateName(job->state)
+                << "  " << job->commandLine << "\n";
+            job->reported = true;
+        }
+    }
+
+    size_t finished = 0;
+    for (const auto& job : jobs_) {
+        if (job->reported) ++finished;
+    }
+    // jobs_ is in launch order, so this drops the oldest first. A worker
+    // no longer needs mutex_ once its job is marked finished, so joining
+    // here cannot deadlock.
+    for (auto it = jobs_.begin(); it != jobs_.end() && finished > kMaxFinishedJobs;) {
+        if ((*it)->reported) {
+            if ((*it)->worker.joinable()) {
+                (*it)->worker.join();
+            }
+            it = jobs_.erase(it);
+            --finished;
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct FileSystemContext;
+struct Job;
+
+// Thread-safe output sink for a background job. The job writes through an
+// ostream on top of it; the foreground drains what has accumulated.
+class JobOutputBuffer : public streambuf {
+public:
+    string drain();
+
+protected:
+    int_type overflow(int_type ch) override;
+    streamsize xsputn(const char* s, streamsize n) override;
+
+private:
+    mutex mutex_;
+    string data_;
+};
+
+enum class JobState { Running, Done, Killed, Failed };
+
+struct JobSummary {
+    int id;
+    string commandLine;
+    JobState state;
+};
+
+// Commands started with a trailing '&'. Each job runs on its own worker
+// thread against a snapshot of the FileSystemContext taken at launch, so a
+// later cd in the foreground cannot affect it.
+class JobTable {
+public:
+    using Body = function<void(FileSystemContext& jobCtx)>;
+
+    JobTable() = default;
+    ~JobTable();
+
+    JobTable(const JobTable&) = delete;
+    JobTable& operator=(const JobTable&) = delete;
+
+    // Start body on a worker thread; returns the job id
+    int launch(const string& commandLine, const FileSystemContext& ctx, Body body);
+
+    vector<JobSummary> list() const;
+
+    // Replay the job's buffered output to out and keep streaming until it
+    // finishes, then drop it from the table. If interrupted() turns true
+    // while waiting (Ctrl-C), the job is killed. Returns false for unknown ids.
+    bool foreground(int id, ostream& out, const function<bool()>& interrupted);
+
+    // Request cancellation; returns false for unknown or finished jobs
+    bool kill(int id);
+
+    // Print a one-line notice for jobs that finished since the last call.
+    // Only the last few reported jobs are kept for fg; older ones are dropped.
+    void reportFinished(ostream& out);
+
+private:
+    shared_ptr<Job> findLocked(int id) const;
+
+    mutable mutex mutex_;
+    condition_variable changed_;
+    vector<shared_ptr<Job>> jobs_;
+    int nextId_{1};
+};
+
+const char* jobStateName(JobState state);
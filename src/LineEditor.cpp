@@ -0,0 +1,318 @@
+#include "LineEditor.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+using namespace std;
+
+static constexpr size_t kMaxHistory = 500;
+
+namespace {
+
+// Raw input for the duration of one line; restored on scope exit
+class RawMode {
+public:
+    RawMode() {
+        ok_ = tcgetattr(STDIN_FILENO, &saved_) == 0;
+        if (!ok_) {
+            return;
+        }
+        termios raw = saved_;
+        raw.c_lflag &= ~(ICANON | ECHO | IEXTEN | ISIG);
+        raw.c_iflag &= ~(IXON | ICRNL);
+        // Output processing stays on, so "\n" still starts a new line
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        // TCSADRAIN rather than TCSAFLUSH: keep type-ahead and pasted lines
+        ok_ = tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == 0;
+    }
+
+    ~RawMode() {
+        if (ok_) {
+            tcsetattr(STDIN_FILENO, TCSADRAIN, &saved_);
+        }
+    }
+
+    bool ok() const { return ok_; }
+
+private:
+    termios saved_{};
+    bool ok_{false};
+};
+
+int readByte() {
+    for (;;) {
+        unsigned char c;
+        ssize_t n = read(STDIN_FILENO, &c, 1);
+        if (n == 1) return c;
+        if (n < 0 && errno == EINTR) continue;
+        return -1;
+    }
+}
+
+void writeOut(const string& s) {
+    const char* p = s.data();
+    size_t left = s.size();
+    while (left > 0) {
+        ssize_t n = write(STDOUT_FILENO, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        p += n;
+        left -= static_cast<size_t>(n);
+    }
+}
+
+size_t terminalWidth() {
+    winsize ws{};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) {
+        return ws.ws_col;
+    }
+    return 80;
+}
+
+// The cursor moves and counts columns by UTF-8 code point
+bool isContinuation(char c) {
+    return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+size_t columns(const string& s, size_t from, size_t to) {
+    size_t n = 0;
+    for (size_t i = from; i < to; ++i) {
+        if (!isContinuation(s[i])) ++n;
+    }
+    return n;
+}
+
+size_t byteAtColumn(const string& s, size_t column) {
+    size_t i = 0;
+    for (size_t col = 0; i < s.size(); ++i) {
+        if (!isContinuation(s[i])) {
+            if (col == column) break;
+            ++col;
+        }
+    }
+    return i;
+}
+
+size_t prevChar(const string& s, size_t pos) {
+    while (pos > 0 && isContinuation(s[--pos])) {
+    }
+    return pos;
+}
+
+size_t nextChar(const string& s, size_t pos) {
+    if (pos < s.size()) ++pos;
+    while (pos < s.size() && isContinuation(s[pos])) ++pos;
+    return pos;
+}
+
+} // namespace
+
+LineEditor::LineEditor() {
+    const char* term = getenv("TERM");
+    terminal_ = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) &&
+                !(term && strcmp(term, "dumb") == 0);
+}
+
+bool LineEditor::readLine(const string& prompt, string& line) {
+    if (terminal_) {
+        cout << flush;
+        RawMode raw;
+        if (raw.ok()) {
+            return readLineRaw(prompt, line);
+        }
+    }
+    cout << prompt;
+    return static_cast<bool>(getline(cin, line));
+}
+
+// Redraw the input line; lines wider than the terminal scroll sideways so
+// the cursor stays visible
+void LineEditor::refresh(const string& prompt, const string& line, size_t cursor) const {
+    size_t promptColumns = columns(prompt, 0, prompt.size());
+    size_t width = terminalWidth();
+    size_t room = width > promptColumns + 8 ? width - promptColumns - 1 : 8;
+
+    size_t cursorColumn = columns(line, 0, cursor);
+    size_t firstColumn = cursorColumn > room ? cursorColumn - room : 0;
+    size_t from = byteAtColumn(line, firstColumn);
+    size_t to = byteAtColumn(line, firstColumn + room);
+
+    string frame = "\r" + prompt + line.substr(from, to - from) + "\x1b[K\r";
+    size_t column = promptColumns + cursorColumn - firstColumn;
+    if (column > 0) {
+        frame += "\x1b[" + to_string(column) + "C";
+    }
+    writeOut(frame);
+}
+
+void LineEditor::completeAt(string& line, size_t& cursor) {
+    if (!complete_) {
+        return;
+    }
+    CompletionResult result = complete_(line, cursor);
+    if (result.total == 0) {
+        writeOut("\a");
+        return;
+    }
+
+    string insert = result.replacement + (result.appendSpace ? " " : "");
+    size_t typed = cursor - result.wordStart;
+    if (insert.size() > typed) {
+        line.replace(result.wordStart, typed, insert);
+        cursor = result.wordStart + insert.size();
+        return;
+    }
+
+    // Nothing more to insert: list the candidates below the line
+    size_t longest = 0;
+    for (const auto& name : result.shown) {
+        longest = max(longest, columns(name, 0, name.size()));
+    }
+    size_t cellWidth = longest + 2;
+    size_t perRow = max<size_t>(1, terminalWidth() / cellWidth);
+    string listing = "\n";
+    for (size_t i = 0; i < result.shown.size(); ++i) {
+        const string& name = result.shown[i];
+        listing += name;
+        if ((i + 1) % perRow == 0 || i + 1 == result.shown.size()) {
+            listing += "\n";
+        } else {
+            listing += string(cellWidth - columns(name, 0, name.size()), ' ');
+        }
+    }
+    if (result.total > result.shown.size()) {
+        listing += "... and " + to_string(result.total - result.shown.size()) + " more\n";
+    }
+    writeOut(listing);
+}
+
+bool LineEditor::readLineRaw(const string& prompt, string& line) {
+    line.clear();
+    size_t cursor = 0;
+    size_t historyIndex = history_.size();
+    string pending;  // The new line while browsing history
+
+    auto showHistory = [&](size_t index) {
+        if (historyIndex == history_.size()) {
+            pending = line;
+        }
+        historyIndex = index;
+        line = historyIndex == history_.size() ? pending : history_[historyIndex];
+        cursor = line.size();
+    };
+
+    refresh(prompt, line, cursor);
+    for (;;) {
+        int c = readByte();
+        if (c < 0) {
+            writeOut("\n");
+            return !line.empty();
+        }
+
+        switch (c) {
+            case '\r':
+            case '\n':
+                writeOut("\n");
+                if (!line.empty() && (history_.empty() || history_.back() != line)) {
+                    history_.push_back(line);
+                    if (history_.size() > kMaxHistory) {
+                        history_.erase(history_.begin());
+                    }
+                }
+                return true;
+            case 3:  // Ctrl-C: drop the line
+                writeOut("^C\n");
+                line.clear();
+                return true;
+            case 4:  // Ctrl-D
+                if (line.empty()) {
+                    writeOut("\n");
+                    return false;
+                }
+                if (cursor < line.size()) {
+                    line.erase(cursor, nextChar(line, cursor) - cursor);
+                }
+                break;
+            case '\t':
+                completeAt(line, cursor);
+                break;
+            case 127:
+            case 8:  // Backspace
+                if (cursor > 0) {
+                    size_t prev = prevChar(line, cursor);
+                    line.erase(prev, cursor - prev);
+                    cursor = prev;
+                }
+                break;
+            case 1:  cursor = 0; break;                         // Ctrl-A
+            case 5:  cursor = line.size(); break;               // Ctrl-E
+            case 2:  cursor = prevChar(line, cursor); break;    // Ctrl-B
+            case 6:  cursor = nextChar(line, cursor); break;    // Ctrl-F
+            case 11: line.erase(cursor); break;                 // Ctrl-K
+            case 21:                                            // Ctrl-U
+                line.erase(0, cursor);
+                cursor = 0;
+                break;
+            case 23: {                                          // Ctrl-W
+                size_t start = cursor;
+                while (start > 0 && line[start - 1] == ' ') --start;
+                while (start > 0 && line[start - 1] != ' ') --start;
+                line.erase(start, cursor - start);
+                cursor = start;
+                break;
+            }
+            case 12:  // Ctrl-L
+                writeOut("\x1b[H\x1b[2J");
+                break;
+            case 16:  // Ctrl-P
+                if (historyIndex > 0) showHistory(historyIndex - 1);
+                break;
+            case 14:  // Ctrl-N
+                if (historyIndex < history_.size()) showHistory(historyIndex + 1);
+                break;
+            case 27: {  // Escape sequences: ESC [ X, ESC O X, ESC [ N ~
+                int c1 = readByte();
+                if (c1 != '[' && c1 != 'O') break;
+                int c2 = readByte();
+                if (c2 >= '0' && c2 <= '9') {
+                    int c3 = readByte();
+                    if (c3 != '~') break;
+                    if (c2 == '3' && cursor < line.size()) {
+                        line.erase(cursor, nextChar(line, cursor) - cursor);
+                    } else if (c2 == '1' || c2 == '7') {
+                        cursor = 0;
+                    } else if (c2 == '4' || c2 == '8') {
+                        cursor = line.size();
+                    }
+                    break;
+                }
+                switch (c2) {
+                    case 'A': if (historyIndex > 0) showHistory(historyIndex - 1); break;
+                    case 'B': if (historyIndex < history_.size()) showHistory(historyIndex + 1); break;
+                    case 'C': cursor = nextChar(line, cursor); break;
+                    case 'D': cursor = prevChar(line, cursor); break;
+                    case 'H': cursor = 0; break;
+                    case 'F': cursor = line.size(); break;
+                    default: break;
+                }
+                break;
+            }
+            default:
+                if (c >= 32) {
+                    line.insert(cursor, 1, static_cast<char>(c));
+                    ++cursor;
+                }
+                break;
+        }
+        refresh(prompt, line, cursor);
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Completion.h"
+
+using namespace std;
+
+// Minimal readline replacement for the interactive prompt. On a terminal:
+// cursor movement (arrows, Home/End, Ctrl-A/E/B/F), Backspace/Delete,
+// Ctrl-U/K/W, history (Up/Down), Ctrl-C to discard the line, Ctrl-D on an
+// empty line for end of input, and Tab completion. The terminal is only in
+// raw mode while a line is being read, so commands run with the normal
+// Ctrl-C handling. Without a terminal it is plain getline.
+class LineEditor {
+public:
+    using CompleteFn = function<CompletionResult(const string& line, size_t cursor)>;
+
+    LineEditor();
+
+    void setCompleter(CompleteFn complete) { complete_ = move(complete); }
+
+    // Print prompt (the text on the input line) and read one line; false
+    // at end of input
+    bool readLine(const string& prompt, string& line);
+
+private:
+    bool readLineRaw(const string& prompt, string& line);
+    void refresh(const string& prompt, const string& line, size_t cursor) const;
+    void completeAt(string& line, size_t& cursor);
+
+    bool terminal_;
+    CompleteFn complete_;
+    vector<string> history_;
+};
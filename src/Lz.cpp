@@ -0,0 +1,216 @@
+#include "Lz.h"
+
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Block layout: sequences of
+//   token         high nibble literal count, low nibble match length - 4;
+//                 15 in either means more length bytes follow (255 = go on)
+//   literals
+//   offset        2 bytes little-endian, 1..65535 back from the output
+//   match length extension bytes
+// The last sequence has literals only and ends the block.
+
+static constexpr size_t kMinMatch = 4;
+static constexpr size_t kMaxOffset = 65535;
+static constexpr int kHashBits = 14;
+// Matches stop this far from the end so the block ends with literals
+static constexpr size_t kEndLiterals = 5;
+
+namespace {
+
+uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+uint32_t hashSequence(uint32_t v) {
+    return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+class Writer {
+public:
+    Writer(uint8_t* dst, size_t cap) : p_(dst), end_(dst + cap), begin_(dst) {}
+
+    bool ok() const { return ok_; }
+    size_t size() const { return static_cast<size_t>(p_ - begin_); }
+
+    uint8_t* reserveToken() {
+        if (p_ >= end_) {
+            ok_ = false;
+            return nullptr;
+        }
+        return p_++;
+    }
+
+    void length(size_t extra) {
+        while (ok_ && extra >= 255) {
+            byte(255);
+            extra -= 255;
+        }
+        byte(static_cast<uint8_t>(extra));
+    }
+
+    void bytes(const uint8_t* src, size_t n) {
+        if (static_cast<size_t>(end_ - p_) < n) {
+            ok_ = false;
+            return;
+        }
+        memcpy(p_, src, n);
+        p_ += n;
+    }
+
+    void byte(uint8_t b) {
+        if (p_ >= end_) {
+            ok_ = false;
+            return;
+        }
+        *p_++ = b;
+    }
+
+private:
+    uint8_t* p_;
+    uint8_t* end_;
+    uint8_t* begin_;
+    bool ok_{true};
+};
+
+void emitSequence(Writer& w, const uint8_t* literals, size_t literalCount,
+                  size_t offset, size_t matchLength) {
+    uint8_t* token = w.reserveToken();
+    if (!token) {
+        return;
+    }
+    uint8_t litNibble = static_cast<uint8_t>(literalCount < 15 ? literalCount : 15);
+    *token = static_cast<uint8_t>(litNibble << 4);
+    if (literalCount >= 15) {
+        w.length(literalCount - 15);
+    }
+    w.bytes(literals, literalCount);
+    if (matchLength == 0) {
+        return;  // Final literal run
+    }
+    w.byte(static_cast<uint8_t>(offset & 0xff));
+    w.byte(static_cast<uint8_t>(offset >> 8));
+    size_t m = matchLength - kMinMatch;
+    *token |= static_cast<uint8_t>(m < 15 ? m : 15);
+    if (m >= 15) {
+        w.length(m - 15);
+    }
+}
+
+} // namespace
+
+size_t lzCompress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap) {
+    Writer w(dst, cap);
+    size_t anchor = 0;
+
+    if (n > kMinMatch + kEndLiterals) {
+        // Positions are stored +1 so that 0 means empty
+        vector<uint32_t> table(size_t(1) << kHashBits, 0);
+        const size_t matchLimit = n - kEndLiterals;
+        size_t ip = 0;
+
+        while (ip + kMinMatch <= matchLimit) {
+            uint32_t seq = read32(src + ip);
+            uint32_t& slot = table[hashSequence(seq)];
+            size_t ref = slot;
+            slot = static_cast<uint32_t>(ip + 1);
+
+            if (ref == 0 || ip - (ref - 1) > kMaxOffset || read32(src + ref - 1) != seq) {
+                // Step faster through data that keeps missing
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            --ref;
+
+            size_t length = kMinMatch;
+            while (ip + length < matchLimit && src[ref + length] == src[ip + length]) {
+                ++length;
+            }
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                --ip;
+                --ref;
+                ++length;
+            }
+
+            emitSequence(w, src + anchor, ip - anchor, ip - ref, length);
+            if (!w.ok()) {
+                return 0;
+            }
+            ip += length;
+            anchor = ip;
+            if (ip >= 2 && ip + kMinMatch <= n) {
+                table[hashSequence(read32(src + ip - 2))] = static_cast<uint32_t>(ip - 2 + 1);
+            }
+        }
+    }
+
+    emitSequence(w, src + anchor, n - anchor, 0, 0);
+    return w.ok() ? w.size() : 0;
+}
+
+bool lzDecompress(const uint8_t* src, size_t n, uint8_t* dst, size_t rawSize) {
+    const uint8_t* ip = src;
+    const uint8_t* const ipEnd = src + n;
+    size_t op = 0;
+
+    auto readLength = [&](size_t& length) {
+        uint8_t b;
+        do {
+            if (ip >= ipEnd) {
+                return false;
+            }
+            b = *ip++;
+            length += b;
+        } while (b == 255);
+        return true;
+    };
+
+    while (ip < ipEnd) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(literals)) {
+            return false;
+        }
+        if (literals > static_cast<size_t>(ipEnd - ip) || literals > rawSize - op) {
+            return false;
+        }
+        memcpy(dst + op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        if (ip == ipEnd) {
+            break;  // Final literal run
+        }
+
+        if (ipEnd - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        size_t length = token & 15;
+        if (length == 15 && !readLength(length)) {
+            return false;
+        }
+        length += kMinMatch;
+        if (offset == 0 || offset > op || length > rawSize - op) {
+            return false;
+        }
+        const uint8_t* from = dst + op - offset;
+        if (offset >= length) {
+            memcpy(dst + op, from, length);
+        } else {
+            // Overlapping match (a run): byte by byte, reading what it writes
+            for (size_t i = 0; i < length; ++i) {
+                dst[op + i] = from[i];
+            }
+        }
+        op += length;
+    }
+    return op == rawSize;
+}
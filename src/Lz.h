@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// Small LZ77 block codec in the LZ4 style: greedy matching through a hash
+// table of 4-byte sequences, 64 KiB window, byte-aligned tokens. Built for
+// speed over ratio; no external dependency.
+
+// Compress n bytes of src into dst (capacity cap). Returns the compressed
+// size, or 0 if it would not fit: callers then store the block raw.
+size_t lzCompress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap);
+
+// Decompress exactly rawSize bytes. Returns false on malformed input; never
+// reads or writes out of bounds.
+bool lzDecompress(const uint8_t* src, size_t n, uint8_t* dst, size_t rawSize);
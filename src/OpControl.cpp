@@ -0,0 +1,101 @@
+#include "OpControl.h"
+
+#include <cstdio>
+
+using namespace std;
+
+// Don't draw anything for commands that finish quickly
+static constexpr int64_t kFirstReportNs = 500'000'000;
+static constexpr int64_t kReportIntervalNs = 200'000'000;
+
+static string formatRate(double value, const char* unit) {
+    static const char* prefixes[] = {"", "K", "M", "G", "T"};
+    int i = 0;
+    while (value >= 1024.0 && i < 4) {
+        value /= 1024.0;
+        ++i;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.1f %s%s", value, prefixes[i], unit);
+    return buf;
+}
+
+void OpControl::begin(const string& label) {
+    cancelled_.store(false);
+    entries_.store(0);
+    bytes_.store(0);
+    dirsDiscovered_.store(0);
+    dirsDone_.store(0);
+    nextReportNs_.store(kFirstReportNs);
+    label_ = label;
+    lineDrawn_ = false;
+    start_ = chrono::steady_clock::now();
+}
+
+void OpControl::end() {
+    lock_guard<mutex> lock(printMutex_);
+    if (lineDrawn_) {
+        fputs("\r\033[K", stderr);
+        fflush(stderr);
+        lineDrawn_ = false;
+    }
+}
+
+void OpControl::addEntry(uintmax_t bytes) {
+    uint64_t n = entries_.fetch_add(1, memory_order_relaxed);
+    if (bytes) {
+        bytes_.fetch_add(bytes, memory_order_relaxed);
+    }
+    // Reading the clock on every entry would dominate fast walks
+    if ((n & 0xff) == 0) {
+        maybeReport();
+    }
+}
+
+void OpControl::dirDone() {
+    dirsDone_.fetch_add(1, memory_order_relaxed);
+    maybeReport();
+}
+
+void OpControl::maybeReport() {
+    if (!progressEnabled_) {
+        return;
+    }
+
+    int64_t elapsedNs = chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now() - start_).count();
+    int64_t due = nextReportNs_.load(memory_order_relaxed);
+    if (elapsedNs < due) {
+        return;
+    }
+    // Only one thread draws each interval
+    if (!nextReportNs_.compare_exchange_strong(due, elapsedNs + kReportIntervalNs)) {
+        return;
+    }
+
+    double secs = elapsedNs / 1e9;
+    uint64_t entries = entries_.load(memory_order_relaxed);
+    uint64_t bytes = bytes_.load(memory_order_relaxed);
+    uint64_t discovered = dirsDiscovered_.load(memory_order_relaxed);
+    uint64_t done = dirsDone_.load(memory_order_relaxed);
+
+    char eta[48] = "";
+    if (done > 0 && discovered > done) {
+        // Assumes the pending directories cost as much as the finished ones
+        double remaining = secs * double(discovered - done) / double(done);
+        snprintf(eta, sizeof(eta), ", ETA ~%.0fs", remaining);
+    }
+
+    lock_guard<mutex> lock(printMutex_);
+    fprintf(stderr, "\r\033[K[%s] %llu entries (%s), %s (%s), dirs %llu/%llu%s",
+            label_.c_str(),
+            (unsigned long long)entries,
+            formatRate(entries / secs, "/s").c_str(),
+            formatRate(double(bytes), "B").c_str(),
+            formatRate(bytes / secs, "B/s").c_str(),
+            (unsigned long long)done,
+            (unsigned long long)discovered,
+            eta);
+    fflush(stderr);
+    lineDrawn_ = true;
+}
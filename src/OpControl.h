@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// Thrown by long-running fsutil operations once their OpControl is cancelled
+struct OperationCancelled : runtime_error {
+    OperationCancelled() : runtime_error("Operation cancelled") {}
+};
+
+// Control block for one command invocation: a cooperative cancellation
+// token plus counters for a rate-limited progress line on stderr.
+// cancel() only stores to a lock-free atomic, so it is safe to call from a
+// signal handler.
+class OpControl {
+public:
+    // Start a new operation: clears cancellation and counters
+    void begin(const string& label);
+    // Erase the progress line if one was drawn
+    void end();
+
+    void cancel() { cancelled_.store(true, memory_order_relaxed); }
+    bool cancelled() const { return cancelled_.load(memory_order_relaxed); }
+    void checkCancelled() const {
+        if (cancelled()) throw OperationCancelled();
+    }
+
+    void setProgressEnabled(bool enabled) { progressEnabled_ = enabled; }
+
+    // Walkers report what they have seen; may redraw the progress line
+    void addEntry(uintmax_t bytes = 0);
+    void dirDiscovered(uint64_t n = 1) { dirsDiscovered_.fetch_add(n, memory_order_relaxed); }
+    void dirDone();
+
+private:
+    void maybeReport();
+
+    atomic<bool> cancelled_{false};
+    atomic<uint64_t> entries_{0};
+    atomic<uint64_t> bytes_{0};
+    atomic<uint64_t> dirsDiscovered_{0};
+    atomic<uint64_t> dirsDone_{0};
+    atomic<int64_t> nextReportNs_{0};
+
+    bool progressEnabled_{false};
+    bool lineDrawn_{false};
+    string label_;
+    chrono::steady_clock::time_point start_;
+    mutex printMutex_;
+};
@@ -0,0 +1,732 @@
+#include "Pack.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "FsUtil.h"
+#include "Lz.h"
+#include "Parallel.h"
+
+using namespace std;
+
+namespace fs = filesystem;
+
+static constexpr char kHeadMagic[8] = {'M', 'F', 'X', 'P', 'A', 'C', 'K', '1'};
+static constexpr char kTailMagic[8] = {'M', 'F', 'X', 'P', 'E', 'N', 'D', '1'};
+static constexpr size_t kTrailerSize = 32;
+static constexpr size_t kChunkHeaderSize = 8;
+static constexpr uint32_t kCompressedFlag = 0x80000000u;
+// Refuse chunks bigger than this when reading, so a corrupt index cannot
+// make extraction allocate without bound
+static constexpr uint32_t kMaxChunkSize = 64 * 1024 * 1024;
+static constexpr size_t kMaxPackErrors = 100;
+
+namespace {
+
+unsigned compressionWorkers(unsigned requested) {
+    if (requested > 0) {
+        return requested;
+    }
+    return max(1u, thread::hardware_concurrency());
+}
+
+// 64-bit content checksum: FNV-style word mixing and a murmur3 finaliser
+uint64_t checksum(const uint8_t* p, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ull ^ n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        h = (h ^ word) * 0x100000001b3ull;
+        h ^= h >> 29;
+    }
+    for (; i < n; ++i) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+void put32(vector<uint8_t>& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+void put64(vector<uint8_t>& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+void putString(vector<uint8_t>& out, const string& s) {
+    put32(out, static_cast<uint32_t>(s.size()));
+    out.insert(out.end(), s.begin(), s.end());
+}
+
+// Bounds-checked reader over the index; any overrun means a corrupt archive
+class IndexReader {
+public:
+    IndexReader(const uint8_t* p, size_t n) : p_(p), n_(n) {}
+
+    uint8_t u8() { need(1); return p_[pos_++]; }
+
+    uint32_t u32() {
+        need(4);
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(p_[pos_ + i]) << (8 * i);
+        pos_ += 4;
+        return v;
+    }
+
+    uint64_t u64() {
+        need(8);
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(p_[pos_ + i]) << (8 * i);
+        pos_ += 8;
+        return v;
+    }
+
+    string str() {
+        uint32_t len = u32();
+        need(len);
+        string s(reinterpret_cast<const char*>(p_ + pos_), len);
+        pos_ += len;
+        return s;
+    }
+
+    bool atEnd() const { return pos_ == n_; }
+
+private:
+    void need(size_t k) {
+        if (n_ - pos_ < k) {
+            throw runtime_error("corrupt archive index");
+        }
+    }
+
+    const uint8_t* p_;
+    size_t n_;
+    size_t pos_{0};
+};
+
+void writeAll(int fd, const void* data, size_t n) {
+    const auto* p = static_cast<const uint8_t*>(data);
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error(string("write failed: ") + strerror(errno));
+        }
+        p += w;
+        n -= static_cast<size_t>(w);
+    }
+}
+
+// Reads up to n bytes at offset; returns how many were available
+size_t preadFull(int fd, void* data, size_t n, uint64_t offset) {
+    auto* p = static_cast<uint8_t*>(data);
+    size_t done = 0;
+    while (done < n) {
+        ssize_t r = pread(fd, p + done, n - done, static_cast<off_t>(offset + done));
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error(string("read failed: ") + strerror(errno));
+        }
+        if (r == 0) break;
+        done += static_cast<size_t>(r);
+    }
+    return done;
+}
+
+// Relative, no "." / ".." / empty components: nothing may land outside the
+// extraction directory
+bool safeRelativePath(const string& path) {
+    if (path.empty() || path[0] == '/') {
+        return false;
+    }
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t slash = path.find('/', start);
+        if (slash == string::npos) slash = path.size();
+        string part = path.substr(start, slash - start);
+        if (part.empty() || part == "." || part == "..") {
+            return false;
+        }
+        start = slash + 1;
+    }
+    return true;
+}
+
+void setTimes(const fs::path& p, int64_t mtimeNs, int flags) {
+    timespec times[2];
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec = static_cast<time_t>(mtimeNs / 1000000000);
+    times[1].tv_nsec = static_cast<long>(mtimeNs % 1000000000);
+    utimensat(AT_FDCWD, p.c_str(), times, flags);
+}
+
+class ErrorLog {
+public:
+    void record(const string& message) {
+        lock_guard<mutex> lock(mutex_);
+        ++count_;
+        if (messages_.size() < kMaxPackErrors) {
+            messages_.push_back(message);
+        }
+    }
+
+    void moveInto(uintmax_t& count, vector<string>& messages) {
+        count = count_;
+        messages = move(messages_);
+    }
+
+private:
+    mutex mutex_;
+    uintmax_t count_{0};
+    vector<string> messages_;
+};
+
+class PackRun {
+public:
+    PackRun(const PackOptions& options, OpControl* ctl) : options_(options), ctl_(ctl) {}
+
+    PackStats run(const fs::path& dir, const fs::path& out);
+
+private:
+    struct Slot {
+        vector<uint8_t> raw;
+        vector<uint8_t> packed;
+        size_t packedSize{0};
+        uint64_t sum{0};
+    };
+
+    void collect(const fs::path& dir, dev_t outDev, ino_t outIno);
+    void fillChunk(uint64_t begin, uint64_t end, vector<uint8_t>& raw);
+    void encodeChunk(size_t index, Slot& slot);
+
+    const PackOptions& options_;
+    OpControl* ctl_;
+    fs::path dir_;
+    vector<PackEntry> entries_;
+    vector<size_t> files_;  // Non-empty files, in stream order
+    uint64_t streamSize_{0};
+    ErrorLog errors_;
+    PackStats stats_;
+};
+
+void PackRun::collect(const fs::path& dir, dev_t outDev, ino_t outIno) {
+    fsutil::WalkOptions walkOptions;
+    walkOptions.ctl = ctl_;
+    vector<vector<PackEntry>> perWorker(walkOptions.workers);
+    fsutil::walkParallel(dir, walkOptions, [&](fsutil::WalkEntry& entry) {
+        const struct stat* st = entry.stat();
+        if (!st) {
+            errors_.record(entry.path().lexically_relative(dir).generic_string() + ": cannot stat");
+            return false;
+        }
+        if (st->st_dev == outDev && st->st_ino == outIno) {
+            return false;  // The archive being written
+        }
+
+        PackEntry item;
+        if (S_ISDIR(st->st_mode)) {
+            item.kind = PackEntry::Dir;
+        } else if (S_ISREG(st->st_mode)) {
+            item.kind = PackEntry::File;
+            item.size = static_cast<uint64_t>(st->st_size);
+        } else if (S_ISLNK(st->st_mode)) {
+            item.kind = PackEntry::Symlink;
+            error_code ec;
+            item.target = fs::read_symlink(entry.path(), ec).string();
+            if (ec) {
+                errors_.record(entry.path().lexically_relative(dir).generic_string() + ": " + ec.message());
+                return false;
+            }
+        } else {
+            return false;  // Devices, sockets, fifos are not archived
+        }
+        item.path = entry.path().lexically_relative(dir).generic_string();
+        item.mode = static_cast<uint32_t>(st->st_mode & 07777);
+        item.mtimeNs = static_cast<int64_t>(st->st_mtim.tv_sec) * 1000000000 + st->st_mtim.tv_nsec;
+        bool descend = item.kind == PackEntry::Dir;
+        perWorker[entry.worker()].push_back(move(item));
+        return descend;
+    });
+
+    for (auto& part : perWorker) {
+        move(part.begin(), part.end(), back_inserter(entries_));
+    }
+    // Path order puts every directory before its contents
+    sort(entries_.begin(), entries_.end(), [](const PackEntry& a, const PackEntry& b) {
+        return a.path < b.path;
+    });
+
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        PackEntry& e = entries_[i];
+        switch (e.kind) {
+            case PackEntry::Dir:     ++stats_.dirs; break;
+            case PackEntry::Symlink: ++stats_.symlinks; break;
+            case PackEntry::File:
+                ++stats_.files;
+                e.offset = streamSize_;
+                streamSize_ += e.size;
+                if (e.size > 0) files_.push_back(i);
+                break;
+        }
+    }
+}
+
+// Read stream bytes [begin, end) from the files they belong to
+void PackRun::fillChunk(uint64_t begin, uint64_t end, vector<uint8_t>& raw) {
+    raw.assign(static_cast<size_t>(end - begin), 0);
+    auto it = partition_point(files_.begin(), files_.end(), [&](size_t i) {
+        return entries_[i].offset + entries_[i].size <= begin;
+    });
+    for (; it != files_.end() && entries_[*it].offset < end; ++it) {
+        if (ctl_) ctl_->checkCancelled();
+        const PackEntry& e = entries_[*it];
+        uint64_t from = max(begin, e.offset);
+        uint64_t to = min(end, e.offset + e.size);
+        fs::path path = dir_ / e.path;
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0) {
+            errors_.record(e.path + ": " + strerror(errno));
+            continue;
+        }
+        size_t want = static_cast<size_t>(to - from);
+        size_t got = 0;
+        try {
+            got = preadFull(fd, raw.data() + (from - begin), want, from - e.offset);
+        } catch (const exception& ex) {
+            errors_.record(e.path + ": " + ex.what());
+        }
+        close(fd);
+        if (got < want && from + got < to) {
+            errors_.record(e.path + ": file shrank while packing");
+        }
+        if (ctl_) ctl_->addEntry(got);
+    }
+}
+
+void PackRun::encodeChunk(size_t index, Slot& slot) {
+    uint64_t begin = static_cast<uint64_t>(index) * options_.chunkSize;
+    uint64_t end = min(streamSize_, begin + options_.chunkSize);
+    fillChunk(begin, end, slot.raw);
+    slot.sum = checksum(slot.raw.data(), slot.raw.size());
+    // Compressed output must be strictly smaller to be worth keeping
+    slot.packed.resize(slot.raw.size());
+    slot.packedSize = slot.raw.size() > 1
+        ? lzCompress(slot.raw.data(), slot.raw.size(), slot.packed.data(), slot.raw.size() - 1)
+        : 0;
+}
+
+PackStats PackRun::run(const fs::path& dir, const fs::path& out) {
+    dir_ = dir;
+    int fd = open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw runtime_error("cannot create " + out.string() + ": " + strerror(errno));
+    }
+
+    try {
+        struct stat outSt;
+        fstat(fd, &outSt);
+        collect(dir, outSt.st_dev, outSt.st_ino);
+
+        vector<uint8_t> index;
+        put64(index, entries_.size());
+        for (const auto& e : entries_) {
+            index.push_back(e.kind);
+            put32(index, e.mode);
+            put64(index, static_cast<uint64_t>(e.mtimeNs));
+            put64(index, e.size);
+            put64(index, e.offset);
+            putString(index, e.path);
+            putString(index, e.target);
+        }
+
+        writeAll(fd, kHeadMagic, sizeof(kHeadMagic));
+        uint64_t position = sizeof(kHeadMagic);
+
+        size_t chunkCount = static_cast<size_t>((streamSize_ + options_.chunkSize - 1) / options_.chunkSize);
+        put64(index, chunkCount);
+
+        // Chunks are encoded a window at a time and written in order, which
+        // bounds memory to two buffers per window slot
+        unsigned workers = compressionWorkers(options_.workers);
+        size_t window = static_cast<size_t>(workers) * 2;
+        vector<Slot> slots(min(window, max<size_t>(chunkCount, 1)));
+        for (size_t base = 0; base < chunkCount; base += slots.size()) {
+            size_t count = min(slots.size(), chunkCount - base);
+            parallelFor(count, workers, [&](size_t i, unsigned) {
+                encodeChunk(base + i, slots[i]);
+            });
+
+            for (size_t i = 0; i < count; ++i) {
+                if (ctl_) ctl_->checkCancelled();
+                Slot& slot = slots[i];
+                bool compressed = slot.packedSize > 0;
+                uint32_t rawSize = static_cast<uint32_t>(slot.raw.size());
+                uint32_t storedSize = static_cast<uint32_t>(compressed ? slot.packedSize : slot.raw.size());
+
+                uint8_t header[kChunkHeaderSize];
+                uint32_t flagged = storedSize | (compressed ? kCompressedFlag : 0);
+                memcpy(header, &rawSize, 4);
+                memcpy(header + 4, &flagged, 4);
+                writeAll(fd, header, sizeof(header));
+                writeAll(fd, compressed ? slot.packed.data() : slot.raw.data(), storedSize);
+
+                put64(index, position);
+                put32(index, rawSize);
+                put32(index, flagged);
+                put64(index, slot.sum);
+                position += kChunkHeaderSize + storedSize;
+            }
+        }
+
+        writeAll(fd, index.data(), index.size());
+        vector<uint8_t> trailer;
+        put64(trailer, position);
+        put64(trailer, index.size());
+        put64(trailer, checksum(index.data(), index.size()));
+        trailer.insert(trailer.end(), kTailMagic, kTailMagic + sizeof(kTailMagic));
+        writeAll(fd, trailer.data(), trailer.size());
+        position += index.size() + trailer.size();
+
+        if (close(fd) != 0) {
+            fd = -1;
+            throw runtime_error(string("write failed: ") + strerror(errno));
+        }
+        fd = -1;
+
+        stats_.chunks = chunkCount;
+        stats_.rawBytes = streamSize_;
+        stats_.archiveBytes = position;
+    } catch (...) {
+        if (fd >= 0) close(fd);
+        error_code ec;
+        fs::remove(out, ec);  // No half-written archives
+        throw;
+    }
+
+    errors_.moveInto(stats_.errorCount, stats_.errors);
+    return stats_;
+}
+
+} // namespace
+
+PackStats packTree(const fs::path& dir, const fs::path& out,
+                   const PackOptions& options, OpControl* ctl) {
+    PackRun run(options, ctl);
+    return run.run(dir, out);
+}
+
+// ---- Reading ----
+
+PackReader::PackReader(const fs::path& archive) {
+    fd_ = open(archive.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        throw runtime_error("cannot open " + archive.string() + ": " + strerror(errno));
+    }
+
+    try {
+        struct stat st;
+        fstat(fd_, &st);
+        uint64_t fileSize = static_cast<uint64_t>(st.st_size);
+        char head[sizeof(kHeadMagic)];
+        uint8_t trailer[kTrailerSize];
+        if (fileSize < sizeof(kHeadMagic) + kTrailerSize ||
+            preadFull(fd_, head, sizeof(head), 0) != sizeof(head) ||
+            memcmp(head, kHeadMagic, sizeof(head)) != 0 ||
+            preadFull(fd_, trailer, sizeof(trailer), fileSize - kTrailerSize) != sizeof(trailer) ||
+            memcmp(trailer + 24, kTailMagic, sizeof(kTailMagic)) != 0) {
+            throw runtime_error("not a pack archive");
+        }
+
+        IndexReader tail(trailer, 24);
+        uint64_t indexOffset = tail.u64();
+        uint64_t indexSize = tail.u64();
+        uint64_t indexSum = tail.u64();
+        if (indexOffset < sizeof(kHeadMagic) || indexSize > fileSize ||
+            indexOffset > fileSize - kTrailerSize - indexSize) {
+            throw runtime_error("corrupt archive trailer");
+        }
+
+        vector<uint8_t> index(static_cast<size_t>(indexSize));
+        if (preadFull(fd_, index.data(), index.size(), indexOffset) != index.size() ||
+            checksum(index.data(), index.size()) != indexSum) {
+            throw runtime_error("corrupt archive index");
+        }
+
+        IndexReader in(index.data(), index.size());
+        uint64_t entryCount = in.u64();
+        for (uint64_t i = 0; i < entryCount; ++i) {
+            PackEntry e;
+            uint8_t kind = in.u8();
+            if (kind > PackEntry::Symlink) {
+                throw runtime_error("corrupt archive index");
+            }
+            e.kind = static_cast<PackEntry::Kind>(kind);
+            e.mode = in.u32();
+            e.mtimeNs = static_cast<int64_t>(in.u64());
+            e.size = in.u64();
+            e.offset = in.u64();
+            e.path = in.str();
+            e.target = in.str();
+            if (!safeRelativePath(e.path)) {
+                throw runtime_error("unsafe path in archive: " + e.path);
+            }
+            entries_.push_back(move(e));
+        }
+
+        uint64_t chunkCount = in.u64();
+        uint64_t streamOffset = 0;
+        for (uint64_t i = 0; i < chunkCount; ++i) {
+            Chunk c;
+            c.fileOffset = in.u64();
+            c.rawSize = in.u32();
+            uint32_t flagged = in.u32();
+            c.checksum = in.u64();
+            c.compressed = (flagged & kCompressedFlag) != 0;
+            c.storedSize = flagged & ~kCompressedFlag;
+            c.streamOffset = streamOffset;
+            if (c.rawSize > kMaxChunkSize || c.storedSize > kMaxChunkSize ||
+                c.fileOffset > indexOffset ||
+                indexOffset - c.fileOffset < kChunkHeaderSize + c.storedSize) {
+                throw runtime_error("corrupt archive chunk table");
+            }
+            streamOffset += c.rawSize;
+            chunks_.push_back(c);
+        }
+        if (!in.atEnd()) {
+            throw runtime_error("corrupt archive index");
+        }
+        for (const auto& e : entries_) {
+            if (e.kind == PackEntry::File && (e.offset > streamOffset || e.size > streamOffset - e.offset)) {
+                throw runtime_error("corrupt archive index");
+            }
+        }
+    } catch (...) {
+        close(fd_);
+        throw;
+    }
+}
+
+PackReader::~PackReader() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+vector<size_t> PackReader::select(const vector<string>& filters) const {
+    vector<size_t> selection;
+    if (filters.empty()) {
+        for (size_t i = 0; i < entries_.size(); ++i) selection.push_back(i);
+        return selection;
+    }
+
+    vector<bool> chosen(entries_.size(), false);
+    for (string filter : filters) {
+        while (filter.size() > 2 && filter.compare(0, 2, "./") == 0) filter.erase(0, 2);
+        while (filter.size() > 1 && filter.back() == '/') filter.pop_back();
+
+        bool matched = false;
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            const string& p = entries_[i].path;
+            if (p == filter || (p.size() > filter.size() && p.compare(0, filter.size(), filter) == 0 &&
+                                p[filter.size()] == '/')) {
+                chosen[i] = true;
+                matched = true;
+            }
+        }
+        if (!matched) {
+            throw runtime_error("not in archive: " + filter);
+        }
+    }
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        if (chosen[i]) selection.push_back(i);
+    }
+    return selection;
+}
+
+vector<string> PackReader::conflicts(const vector<size_t>& selection, const fs::path& dir) const {
+    vector<string> found;
+    for (size_t i : selection) {
+        const PackEntry& e = entries_[i];
+        error_code ec;
+        fs::file_status status = fs::symlink_status(dir / e.path, ec);
+        if (!fs::exists(status)) continue;
+        if (e.kind == PackEntry::Dir && fs::is_directory(status)) continue;
+        found.push_back(e.path);
+    }
+    return found;
+}
+
+UnpackStats PackReader::extract(const vector<size_t>& selection, const fs::path& dir, OpControl* ctl,
+                                bool preserveSpecialBits) {
+    UnpackStats stats;
+    // An untrusted archive must not be able to create setuid files
+    const uint32_t modeMask = preserveSpecialBits ? 07777 : 0777;
+    ErrorLog errors;
+    fs::create_directories(dir);
+
+    // Directories and empty file shells first; symlinks last, so no file
+    // write can be redirected through a link the archive itself created
+    vector<size_t> files;  // Created successfully, in stream order
+    for (size_t i : selection) {
+        if (ctl) ctl->checkCancelled();
+        const PackEntry& e = entries_[i];
+        fs::path target = dir / e.path;
+        try {
+            if (e.kind == PackEntry::Dir) {
+                fs::create_directories(target);
+                ++stats.dirs;
+            } else if (e.kind == PackEntry::File) {
+                fs::create_directories(target.parent_path());
+                error_code ec;
+                fs::file_status status = fs::symlink_status(target, ec);
+                if (fs::exists(status) && !fs::is_regular_file(status)) {
+                    fs::remove(target);  // Throws for a non-empty directory
+                }
+                int fd = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+                if (fd < 0) {
+                    throw runtime_error(strerror(errno));
+                }
+                int rc = ftruncate(fd, static_cast<off_t>(e.size));
+                int err = errno;
+                close(fd);
+                if (rc != 0) {
+                    throw runtime_error(strerror(err));
+                }
+                files.push_back(i);
+                ++stats.files;
+            }
+        } catch (const OperationCancelled&) {
+            throw;
+        } catch (const exception& ex) {
+            errors.record(e.path + ": " + ex.what());
+        }
+    }
+
+    // Chunks spanned by the selected files
+    vector<size_t> needed;
+    for (size_t i : files) {
+        const PackEntry& e = entries_[i];
+        if (e.size == 0) continue;
+        auto first = partition_point(chunks_.begin(), chunks_.end(), [&](const Chunk& c) {
+            return c.streamOffset + c.rawSize <= e.offset;
+        });
+        for (auto it = first; it != chunks_.end() && it->streamOffset < e.offset + e.size; ++it) {
+            size_t index = static_cast<size_t>(it - chunks_.begin());
+            if (needed.empty() || needed.back() < index) needed.push_back(index);
+        }
+    }
+
+    unsigned workers = compressionWorkers(0);
+    vector<vector<uint8_t>> storedBuf(workers), rawBuf(workers);
+    atomic<uintmax_t> bytesWritten{0};
+    parallelFor(needed.size(), workers, [&](size_t task, unsigned worker) {
+        if (ctl) ctl->checkCancelled();
+        size_t index = needed[task];
+        const Chunk& c = chunks_[index];
+        vector<uint8_t>& stored = storedBuf[worker];
+        vector<uint8_t>& raw = rawBuf[worker];
+        stored.resize(c.storedSize);
+        raw.resize(c.rawSize);
+
+        if (preadFull(fd_, stored.data(), c.storedSize, c.fileOffset + kChunkHeaderSize) != c.storedSize) {
+            throw runtime_error("archive truncated");
+        }
+        if (c.compressed) {
+            if (!lzDecompress(stored.data(), c.storedSize, raw.data(), c.rawSize)) {
+                throw runtime_error("corrupt data in chunk " + to_string(index));
+            }
+        } else if (c.storedSize != c.rawSize) {
+            throw runtime_error("corrupt archive chunk table");
+        } else {
+            raw.swap(stored);
+        }
+        if (checksum(raw.data(), c.rawSize) != c.checksum) {
+            throw runtime_error("checksum mismatch in chunk " + to_string(index));
+        }
+
+        uint64_t begin = c.streamOffset;
+        uint64_t end = begin + c.rawSize;
+        auto it = partition_point(files.begin(), files.end(), [&](size_t i) {
+            return entries_[i].offset + entries_[i].size <= begin;
+        });
+        for (; it != files.end() && entries_[*it].offset < end; ++it) {
+            const PackEntry& e = entries_[*it];
+            if (e.size == 0) continue;
+            uint64_t from = max(begin, e.offset);
+            uint64_t to = min(end, e.offset + e.size);
+            fs::path target = dir / e.path;
+            int fd = open(target.c_str(), O_WRONLY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd < 0) {
+                errors.record(e.path + ": " + strerror(errno));
+                continue;
+            }
+            const uint8_t* data = raw.data() + (from - begin);
+            size_t left = static_cast<size_t>(to - from);
+            off_t at = static_cast<off_t>(from - e.offset);
+            while (left > 0) {
+                ssize_t n = pwrite(fd, data, left, at);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    errors.record(e.path + ": " + strerror(errno));
+                    break;
+                }
+                data += n;
+                at += n;
+                left -= static_cast<size_t>(n);
+            }
+            close(fd);
+            bytesWritten.fetch_add(to - from - left, memory_order_relaxed);
+            if (ctl) ctl->addEntry(to - from - left);
+        }
+    });
+    stats.chunksRead = needed.size();
+    stats.bytesWritten = bytesWritten.load();
+
+    for (size_t i : selection) {
+        const PackEntry& e = entries_[i];
+        if (e.kind != PackEntry::Symlink) continue;
+        fs::path target = dir / e.path;
+        try {
+            fs::create_directories(target.parent_path());
+            error_code ec;
+            if (fs::exists(fs::symlink_status(target, ec))) {
+                fs::remove(target);
+            }
+            fs::create_symlink(e.target, target);
+            setTimes(target, e.mtimeNs, AT_SYMLINK_NOFOLLOW);
+            ++stats.symlinks;
+        } catch (const exception& ex) {
+            errors.record(e.path + ": " + ex.what());
+        }
+    }
+
+    // Modes and times last; directories deepest first, after their contents
+    for (size_t i : files) {
+        fs::path target = dir / entries_[i].path;
+        chmod(target.c_str(), entries_[i].mode & modeMask);
+        setTimes(target, entries_[i].mtimeNs, 0);
+    }
+    for (auto it = selection.rbegin(); it != selection.rend(); ++it) {
+        const PackEntry& e = entries_[*it];
+        if (e.kind != PackEntry::Dir) continue;
+        fs::path target = dir / e.path;
+        chmod(target.c_str(), e.mode & modeMask);
+        setTimes(target, e.mtimeNs, 0);
+    }
+
+    errors.moveInto(stats.errorCount, stats.errors);
+    return stats;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "OpControl.h"
+
+using namespace std;
+
+// Archive layout (all integers little-endian):
+//   "MFXPACK1"
+//   chunks        [u32 raw size][u32 stored size | 0x80000000 if compressed]
+//                 [stored bytes]; the contents of every file, in path order,
+//                 concatenated into one stream and cut into fixed-size chunks
+//                 that are compressed independently
+//   index         entries (path, kind, mode, mtime, size, stream offset) and
+//                 the chunk table (file offset, sizes, checksum)
+//   trailer       [u64 index offset][u64 index size][u64 index checksum]
+//                 "MFXPEND1"
+// The writer never seeks, and a reader finds everything from the trailer,
+// so one file can be extracted by decompressing only the chunks it spans.
+
+struct PackOptions {
+    size_t chunkSize{1024 * 1024};
+    unsigned workers{0};  // Compression threads; 0 = one per core
+};
+
+struct PackStats {
+    uintmax_t files{0};
+    uintmax_t dirs{0};
+    uintmax_t symlinks{0};
+    uintmax_t chunks{0};
+    uintmax_t rawBytes{0};
+    uintmax_t archiveBytes{0};
+    uintmax_t errorCount{0};
+    vector<string> errors;  // The first few messages only
+};
+
+// Pack the contents of dir (not dir itself) into the archive out. The tree
+// is walked in parallel; chunks are read and compressed on a thread pool and
+// written in order. Unreadable entries are reported in the stats and skipped
+// (a file that shrinks while being read is padded with zeros).
+PackStats packTree(const filesystem::path& dir, const filesystem::path& out,
+                   const PackOptions& options, OpControl* ctl = nullptr);
+
+struct PackEntry {
+    enum Kind : uint8_t { Dir = 0, File = 1, Symlink = 2 };
+
+    string path;    // Relative, '/'-separated
+    Kind kind{File};
+    uint32_t mode{0};
+    int64_t mtimeNs{0};
+    uint64_t size{0};
+    uint64_t offset{0};  // Start of the contents in the chunk stream
+    string target;       // Symlinks only
+};
+
+struct UnpackStats {
+    uintmax_t files{0};
+    uintmax_t dirs{0};
+    uintmax_t symlinks{0};
+    uintmax_t chunksRead{0};
+    uintmax_t bytesWritten{0};
+    uintmax_t errorCount{0};
+    vector<string> errors;
+};
+
+class PackReader {
+public:
+    // Reads and validates the trailer and index; throws on a corrupt archive
+    explicit PackReader(const filesystem::path& archive);
+    ~PackReader();
+
+    PackReader(const PackReader&) = delete;
+    PackReader& operator=(const PackReader&) = delete;
+
+    const vector<PackEntry>& entries() const { return entries_; }
+
+    // Indices of the entries named by filters, each an exact path or a
+    // directory prefix; everything when filters is empty. Throws if a
+    // filter matches nothing.
+    vector<size_t> select(const vector<string>& filters) const;
+
+    // Selected entries that already exist below dir
+    vector<string> conflicts(const vector<size_t>& selection,
+                             const filesystem::path& dir) const;
+
+    // Extract the selected entries below dir, overwriting existing files.
+    // Only the chunks the selection spans are read; they are decompressed
+    // and written on a thread pool. Checksum mismatches throw. Like tar,
+    // setuid/setgid/sticky bits are dropped unless preserveSpecialBits.
+    UnpackStats extract(const vector<size_t>& selection, const filesystem::path& dir,
+                        OpControl* ctl = nullptr, bool preserveSpecialBits = false);
+
+private:
+    struct Chunk {
+        uint64_t fileOffset;  // Of the chunk header
+        uint64_t streamOffset;
+        uint32_t rawSize;
+        uint32_t storedSize;
+        bool compressed;
+        uint64_t checksum;
+    };
+
+    int fd_{-1};
+    vector<PackEntry> entries_;
+    vector<Chunk> chunks_;
+};
@@ -0,0 +1,68 @@
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "AllocStats.h"
+
+using namespace std;
+
+unsigned defaultWorkerCount() {
+    unsigned hw = thread::hardware_concurrency();
+    return clamp(hw * 2, 4u, 32u);
+}
+
+void parallelFor(size_t count, unsigned workers,
+                 const function<void(size_t index, unsigned worker)>& fn) {
+    if (count == 0) {
+        return;
+    }
+    workers = max(1u, static_cast<unsigned>(min<size_t>(workers, count)));
+
+    atomic<size_t> next{0};
+    atomic<bool> failed{false};
+    exception_ptr firstError;
+    mutex errorMutex;
+
+    auto run = [&](unsigned worker) {
+        for (;;) {
+            size_t i = next.fetch_add(1);
+            if (i >= count || failed.load()) {
+                return;
+            }
+            try {
+                fn(i, worker);
+            } catch (...) {
+                lock_guard<mutex> lock(errorMutex);
+                if (!firstError) {
+                    firstError = current_exception();
+                }
+                failed.store(true);
+                return;
+            }
+        }
+    };
+
+    // The calling thread works too instead of idling in join(). Workers
+    // charge their allocations to the caller's command (see 'mem').
+    AllocAccount* account = boundAllocAccount;
+    vector<thread> threads;
+    for (unsigned w = 1; w < workers; ++w) {
+        threads.emplace_back([&run, account, w] {
+            AllocAccountBinding binding(account);
+            run(w);
+        });
+    }
+    run(0);
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    if (firstError) {
+        rethrow_exception(firstError);
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+using namespace std;
+
+// Worker count for I/O-bound fan-out. Filesystem calls mostly wait on the
+// kernel or the network, so this goes beyond the core count on small boxes.
+unsigned defaultWorkerCount();
+
+// Run fn(index, worker) for every index in [0, count) on up to `workers`
+// threads (worker is in [0, workers)). Indices are handed out dynamically.
+// If any call throws, remaining indices are skipped and the first exception
+// is rethrown on the calling thread once all workers have stopped.
+void parallelFor(size_t count, unsigned workers,
+                 const function<void(size_t index, unsigned worker)>& fn);
@@ -0,0 +1,174 @@
+#include "PathCache.h"
+
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace fs = filesystem;
+
+// Bounds staleness from changes by other processes that the parent stamp
+// cannot see, e.g. a symlink earlier in the path being retargeted
+static constexpr chrono::seconds kMaxAge(5);
+
+PathCache::PathCache(size_t capacity) : capacity_(capacity) {}
+
+PathCache::Stamp PathCache::stampOf(const fs::path& dir) {
+    Stamp stamp;
+    struct stat st;
+    if (stat(dir.c_str(), &st) == 0) {
+        stamp.sec = st.st_mtim.tv_sec;
+        stamp.nsec = st.st_mtim.tv_nsec;
+    }
+    return stamp;
+}
+
+fs::path PathCache::resolve(const fs::path& base, const string& input, const fs::path& home) {
+    if (input.empty()) {
+        return base;
+    }
+
+    string key = base.string();
+    key.push_back('\0');
+    key += input;
+
+    bool found = false;
+    Resolution cached;
+    uint64_t generation;
+    auto now = chrono::steady_clock::now();
+    {
+        shared_lock<shared_mutex> lock(mutex_);
+        generation = generation_;
+        auto it = resolutions_.find(key);
+        if (it != resolutions_.end() && it->second.generation == generation_ &&
+            now - it->second.loadedAt < kMaxAge) {
+            cached = it->second;
+            found = true;
+        }
+    }
+    // The revalidating stat runs outside the lock
+    if (found && cached.parentStamp.sec >= 0 &&
+        cached.parentStamp == stampOf(cached.result.parent_path())) {
+        ++hits_;
+        return cached.result;
+    }
+    ++misses_;
+
+    fs::path absolute;
+    if (input[0] == '~' && !home.empty()) {
+        string expanded = home.string();
+        if (input.size() > 1) {
+            expanded += input.substr(1);
+        }
+        absolute = expanded;
+    } else {
+        fs::path p(input);
+        absolute = p.is_relative() ? base / p : p;
+    }
+
+    // Stamp before resolving, so a change made meanwhile fails the next check
+    fs::path result = resolveComponents(absolute);
+    Stamp stamp = stampOf(result.parent_path());
+
+    unique_lock<shared_mutex> lock(mutex_);
+    if (generation != generation_) {
+        return result;  // Invalidated while resolving: don't cache
+    }
+    if (resolutions_.size() >= capacity_) {
+        resolutions_.clear();
+    }
+    resolutions_[key] = Resolution{result, stamp, generation_, now};
+    return result;
+}
+
+fs::path PathCache::resolveComponents(const fs::path& absolute) {
+    fs::path resolved = absolute.root_path();
+    bool missing = false;
+
+    for (const auto& part : absolute.relative_path()) {
+        if (missing) {
+            // Past the first missing component the rest is purely lexical
+            resolved /= part;
+            continue;
+        }
+        if (part.empty() || part == ".") {
+            continue;
+        }
+        if (part == "..") {
+            // resolved has no symlinks left, so its parent is the real one
+            resolved = resolved.parent_path();
+            continue;
+        }
+
+        fs::path child = resolved / part;
+        string key = child.string();
+        auto now = chrono::steady_clock::now();
+
+        uint64_t generation;
+        {
+            shared_lock<shared_mutex> lock(mutex_);
+            generation = generation_;
+            auto it = dentries_.find(key);
+            if (it != dentries_.end() && it->second.generation == generation_ &&
+                now - it->second.loadedAt < kMaxAge) {
+                ++dentryHits_;
+                resolved = it->second.isSymlink ? it->second.target : child;
+                continue;
+            }
+        }
+        ++dentryMisses_;
+
+        struct stat st;
+        if (lstat(child.c_str(), &st) != 0) {
+            // Not cached: a missing name is usually about to be created
+            missing = true;
+            resolved = child;
+            continue;
+        }
+
+        Dentry dentry;
+        dentry.generation = 0;
+        dentry.loadedAt = now;
+        if (S_ISLNK(st.st_mode)) {
+            error_code ec;
+            fs::path target = fs::canonical(child, ec);
+            if (ec) {
+                // Dangling link: weakly_canonical keeps the name as is
+                missing = true;
+                resolved = child;
+                continue;
+            }
+            dentry.isSymlink = true;
+            dentry.target = target;
+        }
+
+        {
+            unique_lock<shared_mutex> lock(mutex_);
+            if (generation == generation_) {
+                if (dentries_.size() >= capacity_) {
+                    dentries_.clear();
+                }
+                dentry.generation = generation_;
+                dentries_[key] = dentry;
+            }
+        }
+        resolved = dentry.isSymlink ? dentry.target : child;
+    }
+
+    return missing ? resolved.lexically_normal() : resolved;
+}
+
+void PathCache::invalidate() {
+    unique_lock<shared_mutex> lock(mutex_);
+    ++generation_;
+    resolutions_.clear();
+    dentries_.clear();
+}
+
+PathCache::Stats PathCache::stats() const {
+    Stats stats;
+    stats.hits = hits_.load();
+    stats.misses = misses_.load();
+    stats.dentryHits = dentryHits_.load();
+    stats.dentryMisses = dentryMisses_.load();
+    return stats;
+}
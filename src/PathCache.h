@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+// Session cache for resolving user-typed paths, with the same result as
+// fsutil::normalizePath (weakly_canonical) but far fewer stat calls.
+//
+// Two levels:
+//  - whole resolutions keyed on (base, input), revalidated with a single
+//    stat of the result's parent directory (its mtime changes whenever the
+//    leaf is created, removed or renamed);
+//  - per-component dentries (is it a symlink, and where does it point) so a
+//    new input under a known directory only stats the new components.
+// Commands that change the tree call invalidate(); both levels also expire
+// after a few seconds to bound staleness from changes made by other
+// processes (a retargeted symlink earlier in the path does not touch the
+// result's parent, so the stamp alone would not notice it). rm, rmdir and mv
+// do not resolve their arguments through the cache at all.
+//
+// Thread-safe. Lookups only take a shared lock, so the daemon's clients
+// resolve paths concurrently; inserts and invalidate() take it exclusively.
+class PathCache {
+public:
+    struct Stats {
+        uint64_t hits{0};
+        uint64_t misses{0};
+        uint64_t dentryHits{0};
+        uint64_t dentryMisses{0};
+    };
+
+    explicit PathCache(size_t capacity = 4096);
+
+    filesystem::path resolve(const filesystem::path& base, const string& input,
+                             const filesystem::path& home);
+
+    void invalidate();
+
+    Stats stats() const;
+
+private:
+    struct Stamp {
+        int64_t sec{-1};
+        int64_t nsec{0};
+        bool operator==(const Stamp& o) const { return sec == o.sec && nsec == o.nsec; }
+    };
+
+    struct Resolution {
+        filesystem::path result;
+        Stamp parentStamp;
+        uint64_t generation;
+        chrono::steady_clock::time_point loadedAt;
+    };
+
+    struct Dentry {
+        bool isSymlink{false};
+        filesystem::path target;  // Canonical target of a symlink
+        uint64_t generation;
+        chrono::steady_clock::time_point loadedAt;
+    };
+
+    static Stamp stampOf(const filesystem::path& dir);
+    filesystem::path resolveComponents(const filesystem::path& absolute);
+
+    size_t capacity_;
+    mutable shared_mutex mutex_;
+    unordered_map<string, Resolution> resolutions_;
+    unordered_map<string, Dentry> dentries_;
+    uint64_t generation_{0};
+
+    // Bumped under the shared lock by concurrent readers
+    atomic<uint64_t> hits_{0};
+    atomic<uint64_t> misses_{0};
+    atomic<uint64_t> dentryHits_{0};
+    atomic<uint64_t> dentryMisses_{0};
+};
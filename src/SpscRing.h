@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Capacity is rounded up to a power of two.
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    // Producer side; returns false (and leaves value alone) when full
+    bool push(T& value) {
+        size_t tail = tail_.load(memory_order_relaxed);
+        if (tail - head_.load(memory_order_acquire) > mask_) {
+            return false;
+        }
+        slots_[tail & mask_] = move(value);
+        tail_.store(tail + 1, memory_order_release);
+        return true;
+    }
+
+    // Consumer side; returns false when empty
+    bool pop(T& out) {
+        size_t head = head_.load(memory_order_relaxed);
+        if (head == tail_.load(memory_order_acquire)) {
+            return false;
+        }
+        out = move(slots_[head & mask_]);
+        head_.store(head + 1, memory_order_release);
+        return true;
+    }
+
+private:
+    vector<T> slots_;
+    size_t mask_{0};
+    // Separate cache lines so producer and consumer don't false-share
+    alignas(64) atomic<size_t> head_{0};
+    alignas(64) atomic<size_t> tail_{0};
+};
@@ -0,0 +1,319 @@
+#include "Sync.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FsUtil.h"
+#include "Parallel.h"
+
+using namespace std;
+
+namespace fs = filesystem;
+
+static constexpr size_t kMaxSyncErrors = 100;
+// Destination blocks hashed per thread-pool task
+static constexpr size_t kBlocksPerTask = 64;
+
+namespace {
+
+// rsync's weak checksum. rsync rolls it one byte at a time to find blocks
+// at any offset; patching in place only ever compares blocks at the same
+// offset, so here it is computed per block only.
+struct WeakChecksum {
+    uint32_t a{0};
+    uint32_t b{0};
+    uint32_t len{0};
+
+    void init(const unsigned char* p, size_t n) {
+        a = b = 0;
+        len = static_cast<uint32_t>(n);
+        for (size_t i = 0; i < n; ++i) {
+            a += p[i];
+            b += static_cast<uint32_t>(n - i) * p[i];
+        }
+    }
+
+    uint32_t value() const { return (a & 0xffff) | (b << 16); }
+};
+
+// 64-bit strong hash, only computed when the weak checksum matches
+uint64_t strongHash(const unsigned char* p, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ull ^ n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        h = (h ^ word) * 0x100000001b3ull;
+        h ^= h >> 29;
+    }
+    for (; i < n; ++i) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    // murmur3 finaliser
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+struct BlockSignature {
+    uint32_t weak;
+    uint32_t index;
+    uint64_t strong;
+};
+
+class SyncRun {
+public:
+    SyncRun(const SyncOptions& options, OpControl* ctl) : options_(options), ctl_(ctl) {}
+
+    SyncStats run(const fs::path& src, const fs::path& dst);
+
+private:
+    struct Item {
+        fs::path rel;
+        enum Kind { Dir, File, Symlink } kind;
+    };
+
+    void syncDir(const fs::path& dst);
+    void syncSymlink(const fs::path& src, const fs::path& dst);
+    void syncFile(const fs::path& src, const fs::path& dst);
+    void patchInPlace(const fs::path& src, const fs::path& dst);
+    vector<BlockSignature> signatures(int fd, uintmax_t size);
+    void writeRange(int fd, const unsigned char* data, uintmax_t from, uintmax_t to);
+    void recordError(const string& message);
+
+    const SyncOptions& options_;
+    OpControl* ctl_;
+    SyncStats stats_;
+};
+
+SyncStats SyncRun::run(const fs::path& src, const fs::path& dst) {
+    // Collect the source tree first so directories are created before
+    // anything is copied into them
+    fsutil::WalkOptions walkOptions;
+    walkOptions.ctl = ctl_;
+    vector<vector<Item>> perWorker(walkOptions.workers);
+    fsutil::walkParallel(src, walkOptions, [&](fsutil::WalkEntry& entry) {
+        Item::Kind kind = entry.isDirectory() ? Item::Dir
+                        : entry.isSymlink()   ? Item::Symlink
+                                              : Item::File;
+        if (kind == Item::File && !entry.isRegularFile()) {
+            return false;  // Devices, sockets, fifos are not mirrored
+        }
+        perWorker[entry.worker()].push_back(Item{entry.path().lexically_relative(src), kind});
+        return kind == Item::Dir;
+    });
+
+    vector<Item> items;
+    for (auto& part : perWorker) {
+        move(part.begin(), part.end(), back_inserter(items));
+    }
+    sort(items.begin(), items.end(), [](const Item& a, const Item& b) { return a.rel < b.rel; });
+
+    syncDir(dst);
+    for (const auto& item : items) {
+        if (ctl_) ctl_->checkCancelled();
+        fs::path from = src / item.rel;
+        fs::path to = dst / item.rel;
+        try {
+            switch (item.kind) {
+                case Item::Dir:     syncDir(to); break;
+                case Item::Symlink: syncSymlink(from, to); break;
+                case Item::File:    syncFile(from, to); break;
+            }
+        } catch (const OperationCancelled&) {
+            throw;
+        } catch (const exception& e) {
+            recordError(item.rel.string() + ": " + e.what());
+        }
+    }
+    return stats_;
+}
+
+void SyncRun::recordError(const string& message) {
+    ++stats_.errorCount;
+    if (stats_.errors.size() < kMaxSyncErrors) {
+        stats_.errors.push_back(message);
+    }
+}
+
+void SyncRun::syncDir(const fs::path& dst) {
+    if (fs::is_directory(dst)) {
+        return;
+    }
+    ++stats_.dirsCreated;
+    if (!options_.dryRun) {
+        fs::create_directories(dst);
+    }
+}
+
+void SyncRun::syncSymlink(const fs::path& src, const fs::path& dst) {
+    ++stats_.filesScanned;
+    fs::path target = fs::read_symlink(src);
+    error_code ec;
+    if (fs::is_symlink(fs::symlink_status(dst, ec)) && fs::read_symlink(dst, ec) == target) {
+        ++stats_.filesUnchanged;
+        return;
+    }
+    ++stats_.filesCopied;
+    if (!options_.dryRun) {
+        fs::remove(dst, ec);
+        fs::create_symlink(target, dst);
+    }
+}
+
+void SyncRun::syncFile(const fs::path& src, const fs::path& dst) {
+    ++stats_.filesScanned;
+    uintmax_t srcSize = fs::file_size(src);
+    auto srcTime = fs::last_write_time(src);
+    if (ctl_) ctl_->addEntry(srcSize);
+
+    error_code ec;
+    fs::file_status dstStatus = fs::symlink_status(dst, ec);
+    bool dstIsFile = fs::is_regular_file(dstStatus);
+    if (fs::exists(dstStatus) && !dstIsFile) {
+        throw runtime_error("destination exists and is not a regular file");
+    }
+
+    if (dstIsFile && fs::file_size(dst) == srcSize && fs::last_write_time(dst) == srcTime) {
+        ++stats_.filesUnchanged;
+        return;
+    }
+
+    if (dstIsFile && srcSize >= options_.deltaThreshold) {
+        ++stats_.filesPatched;
+        if (!options_.dryRun) {
+            patchInPlace(src, dst);
+            fs::last_write_time(dst, srcTime);
+        }
+        return;
+    }
+
+    ++stats_.filesCopied;
+    stats_.bytesCopied += srcSize;
+    if (!options_.dryRun) {
+        fsutil::copyFile(src, dst, true);
+        // Same mtime, so the next run's size+mtime check can skip it
+        fs::last_write_time(dst, srcTime);
+    }
+}
+
+vector<BlockSignature> SyncRun::signatures(int fd, uintmax_t size) {
+    size_t blockSize = options_.blockSize;
+    size_t blocks = static_cast<size_t>(size / blockSize);  // Full blocks only
+    vector<BlockSignature> sigs(blocks);
+    size_t tasks = (blocks + kBlocksPerTask - 1) / kBlocksPerTask;
+
+    parallelFor(tasks, defaultWorkerCount(), [&](size_t task, unsigned) {
+        vector<unsigned char> buf(blockSize);
+        size_t end = min(blocks, (task + 1) * kBlocksPerTask);
+        for (size_t i = task * kBlocksPerTask; i < end; ++i) {
+            if (ctl_) ctl_->checkCancelled();
+            ssize_t n = pread(fd, buf.data(), blockSize, static_cast<off_t>(i * blockSize));
+            if (n != static_cast<ssize_t>(blockSize)) {
+                throw runtime_error(string("read failed: ") + strerror(errno));
+            }
+            WeakChecksum weak;
+            weak.init(buf.data(), blockSize);
+            sigs[i] = BlockSignature{weak.value(), static_cast<uint32_t>(i),
+                                     strongHash(buf.data(), blockSize)};
+        }
+    });
+    return sigs;  // sigs[i] is block i
+}
+
+void SyncRun::writeRange(int fd, const unsigned char* data, uintmax_t from, uintmax_t to) {
+    while (from < to) {
+        ssize_t n = pwrite(fd, data + from, static_cast<size_t>(to - from),
+                           static_cast<off_t>(from));
+        if (n < 0) {
+            throw runtime_error(string("write failed: ") + strerror(errno));
+        }
+        stats_.bytesWritten += static_cast<uintmax_t>(n);
+        from += static_cast<uintmax_t>(n);
+    }
+}
+
+void SyncRun::patchInPlace(const fs::path& src, const fs::path& dst) {
+    int srcFd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (srcFd < 0) {
+        throw runtime_error(string("cannot open source: ") + strerror(errno));
+    }
+    int dstFd = open(dst.c_str(), O_RDWR | O_CLOEXEC);
+    if (dstFd < 0) {
+        int err = errno;
+        close(srcFd);
+        throw runtime_error(string("cannot open destination: ") + strerror(err));
+    }
+
+    struct stat srcSt, dstSt;
+    fstat(srcFd, &srcSt);
+    fstat(dstFd, &dstSt);
+    uintmax_t srcSize = static_cast<uintmax_t>(srcSt.st_size);
+
+    void* map = nullptr;
+    try {
+        vector<BlockSignature> sigs = signatures(dstFd, static_cast<uintmax_t>(dstSt.st_size));
+
+        map = mmap(nullptr, srcSize, PROT_READ, MAP_PRIVATE, srcFd, 0);
+        if (map == MAP_FAILED) {
+            map = nullptr;
+            throw runtime_error(string("cannot map source: ") + strerror(errno));
+        }
+        madvise(map, srcSize, MADV_SEQUENTIAL);
+        const auto* data = static_cast<const unsigned char*>(map);
+
+        // Rewriting in place, only a block already at the same offset saves
+        // a write: data found at another offset would still have to be
+        // written from the source, and matching it would push every later
+        // block off the grid. So each source block on the grid is compared
+        // with the destination block at its offset.
+        const size_t blockSize = options_.blockSize;
+        uintmax_t literalStart = 0;
+        for (uintmax_t pos = 0; pos + blockSize <= srcSize; pos += blockSize) {
+            if (ctl_) ctl_->checkCancelled();
+            size_t i = static_cast<size_t>(pos / blockSize);
+            if (i >= sigs.size()) {
+                break;  // Past the end of dst: the rest is all literal
+            }
+            WeakChecksum weak;
+            weak.init(data + pos, blockSize);
+            if (weak.value() != sigs[i].weak || strongHash(data + pos, blockSize) != sigs[i].strong) {
+                continue;
+            }
+
+            writeRange(dstFd, data, literalStart, pos);
+            stats_.bytesReused += blockSize;
+            literalStart = pos + blockSize;
+        }
+
+        writeRange(dstFd, data, literalStart, srcSize);
+        if (ftruncate(dstFd, static_cast<off_t>(srcSize)) != 0) {
+            throw runtime_error(string("truncate failed: ") + strerror(errno));
+        }
+    } catch (...) {
+        if (map) munmap(map, srcSize);
+        close(srcFd);
+        close(dstFd);
+        throw;
+    }
+
+    if (map) munmap(map, srcSize);
+    close(srcFd);
+    close(dstFd);
+}
+
+} // namespace
+
+SyncStats syncTrees(const fs::path& src, const fs::path& dst,
+                    const SyncOptions& options, OpControl* ctl) {
+    SyncRun run(options, ctl);
+    return run.run(src, dst);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "OpControl.h"
+
+using namespace std;
+
+struct SyncOptions {
+    size_t blockSize{64 * 1024};
+    // Changed files at least this big are patched block-wise in place;
+    // smaller ones are simply copied again
+    uintmax_t deltaThreshold{4 * 1024 * 1024};
+    bool dryRun{false};
+};
+
+struct SyncStats {
+    uintmax_t filesScanned{0};
+    uintmax_t filesUnchanged{0};
+    uintmax_t filesCopied{0};
+    uintmax_t filesPatched{0};
+    uintmax_t dirsCreated{0};
+    uintmax_t bytesCopied{0};   // Whole-file copies
+    uintmax_t bytesWritten{0};  // Blocks rewritten by patching
+    uintmax_t bytesReused{0};   // Blocks patching left untouched
+    uintmax_t errorCount{0};
+    vector<string> errors;      // The first few messages only
+};
+
+// One-way mirror of src into dst. Files whose size and mtime already match
+// are skipped. Changed large files are patched rsync-style: block signatures
+// of the destination (weak checksum + strong hash, computed on a thread pool)
+// are compared with the source block at the same offset, and only blocks
+// that differ are rewritten, in place. Nothing is deleted from dst.
+SyncStats syncTrees(const filesystem::path& src, const filesystem::path& dst,
+                    const SyncOptions& options, OpControl* ctl = nullptr);
@@ -0,0 +1,138 @@
+#include "TreeStats.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "FsUtil.h"
+
+using namespace std;
+
+namespace fs = filesystem;
+
+// Key limits per walker thread
+static constexpr size_t kMaxExtensions = 1024;
+static constexpr size_t kMaxOwners = 256;
+static constexpr size_t kMaxExtensionLength = 16;
+
+static const string kOtherKey = "(other)";
+static constexpr uint32_t kOtherOwner = UINT32_MAX;
+
+void TreeStats::merge(const TreeStats& o) {
+    files.merge(o.files);
+    dirs += o.dirs;
+    others += o.others;
+    for (const auto& [ext, bucket] : o.byExtension) {
+        byExtension[ext].merge(bucket);
+    }
+    for (const auto& [uid, bucket] : o.byOwner) {
+        byOwner[uid].merge(bucket);
+    }
+    for (size_t i = 0; i < bySizeLog2.size(); ++i) {
+        bySizeLog2[i].merge(o.bySizeLog2[i]);
+    }
+    for (size_t i = 0; i < byAge.size(); ++i) {
+        byAge[i].merge(o.byAge[i]);
+    }
+}
+
+const char* ageBucketName(int bucket) {
+    static const char* names[AgeBucketCount] = {
+        "in the future", "< 1 day", "< 1 week", "< 30 days", "< 90 days",
+        "< 1 year", "< 3 years", ">= 3 years"
+    };
+    return (bucket >= 0 && bucket < AgeBucketCount) ? names[bucket] : "?";
+}
+
+static string extensionOf(const char* name) {
+    const char* dot = strrchr(name, '.');
+    // Leading dot is a hidden file, not an extension
+    if (!dot || dot == name || dot[1] == '\0') {
+        return "(none)";
+    }
+    string ext(dot);
+    if (ext.size() > kMaxExtensionLength) {
+        return "(long)";
+    }
+    transform(ext.begin(), ext.end(), ext.begin(),
+              [](unsigned char c) { return tolower(c); });
+    return ext;
+}
+
+static int ageBucketOf(time_t mtime, time_t now) {
+    if (mtime > now) return AgeFuture;
+    time_t days = (now - mtime) / 86400;
+    if (days < 1) return AgeDay;
+    if (days < 7) return AgeWeek;
+    if (days < 30) return AgeMonth;
+    if (days < 90) return AgeQuarter;
+    if (days < 365) return AgeYear;
+    if (days < 3 * 365) return AgeThreeYears;
+    return AgeOlder;
+}
+
+static size_t sizeBucketOf(uintmax_t size) {
+    size_t bucket = 0;
+    while (size) {
+        ++bucket;
+        size >>= 1;
+    }
+    return bucket;
+}
+
+TreeStats collectTreeStats(const fs::path& dir, OpControl* ctl) {
+    fsutil::WalkOptions options;
+    options.ctl = ctl;
+    vector<TreeStats> perWorker(options.workers);
+    time_t now = time(nullptr);
+
+    fsutil::walkParallel(dir, options, [&](fsutil::WalkEntry& entry) {
+        TreeStats& stats = perWorker[entry.worker()];
+
+        if (entry.isDirectory()) {
+            ++stats.dirs;
+            if (ctl) ctl->addEntry();
+            return true;
+        }
+        if (!entry.isRegularFile()) {
+            ++stats.others;
+            if (ctl) ctl->addEntry();
+            return false;
+        }
+
+        const struct stat* st = entry.stat();
+        if (!st) {
+            return false;
+        }
+        uintmax_t size = static_cast<uintmax_t>(st->st_size);
+        stats.files.add(size);
+        stats.bySizeLog2[sizeBucketOf(size)].add(size);
+        stats.byAge[ageBucketOf(st->st_mtime, now)].add(size);
+
+        string ext = extensionOf(entry.name());
+        auto extIt = stats.byExtension.find(ext);
+        if (extIt == stats.byExtension.end() && stats.byExtension.size() >= kMaxExtensions) {
+            extIt = stats.byExtension.try_emplace(kOtherKey).first;
+        } else if (extIt == stats.byExtension.end()) {
+            extIt = stats.byExtension.try_emplace(ext).first;
+        }
+        extIt->second.add(size);
+
+        uint32_t uid = st->st_uid;
+        if (stats.byOwner.count(uid) == 0 && stats.byOwner.size() >= kMaxOwners) {
+            uid = kOtherOwner;
+        }
+        stats.byOwner[uid].add(size);
+
+        if (ctl) ctl->addEntry(size);
+        return false;
+    });
+
+    TreeStats total;
+    for (const auto& stats : perWorker) {
+        total.merge(stats);
+    }
+    return total;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+
+#include "OpControl.h"
+
+using namespace std;
+
+struct StatBucket {
+    uintmax_t count{0};
+    uintmax_t bytes{0};
+
+    void add(uintmax_t size) {
+        ++count;
+        bytes += size;
+    }
+    void merge(const StatBucket& o) {
+        count += o.count;
+        bytes += o.bytes;
+    }
+};
+
+// File age buckets by modification time
+enum AgeBucket { AgeFuture, AgeDay, AgeWeek, AgeMonth, AgeQuarter, AgeYear, AgeThreeYears,
+                 AgeOlder, AgeBucketCount };
+
+// Aggregates over the regular files of a tree, collected in one walk.
+// Keyed tables have a fixed number of slots per walker thread; anything
+// beyond that lands in the "(other)" row, so memory does not grow with the
+// number of files.
+struct TreeStats {
+    StatBucket files;
+    uintmax_t dirs{0};
+    uintmax_t others{0};  // Symlinks, sockets, devices...
+
+    unordered_map<string, StatBucket> byExtension;
+    unordered_map<uint32_t, StatBucket> byOwner;
+    array<StatBucket, 65> bySizeLog2{};  // [0] = empty, [k] = [2^(k-1), 2^k)
+    array<StatBucket, AgeBucketCount> byAge{};
+
+    void merge(const TreeStats& o);
+};
+
+const char* ageBucketName(int bucket);
+
+// Statistics of everything below dir, on the parallel walker with
+// per-thread tables merged at the end
+TreeStats collectTreeStats(const filesystem::path& dir, OpControl* ctl = nullptr);
@@ -0,0 +1,402 @@
+#include "Watch.h"
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "FsUtil.h"
+
+using namespace std;
+
+namespace fs = filesystem;
+
+static constexpr uint32_t kWatchMask =
+    IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO |
+    IN_DELETE_SELF | IN_ONLYDIR;
+// The kernel queues both halves of a rename together, so an IN_MOVED_FROM
+// still unpaired after this long was a move out of the tree
+static constexpr chrono::milliseconds kMoveGrace(200);
+
+DirWatcher::DirWatcher(const fs::path& root, bool recursive, size_t ringCapacity)
+    : root_(root), recursive_(recursive), ring_(ringCapacity) {}
+
+DirWatcher::~DirWatcher() {
+    stop();
+}
+
+void DirWatcher::start(OpControl* ctl) {
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ < 0) {
+        throw runtime_error(string("inotify unavailable: ") + strerror(errno));
+    }
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd_ < 0) {
+        throw runtime_error(string("eventfd unavailable: ") + strerror(errno));
+    }
+    addTree(root_, ctl);
+    reader_ = thread(&DirWatcher::readerLoop, this);
+    if (recursive_) {
+        registrar_ = thread(&DirWatcher::registrarLoop, this);
+    }
+}
+
+void DirWatcher::stop() {
+    {
+        lock_guard<mutex> lock(registerMutex_);
+        stopping_.store(true);
+    }
+    registrarCtl_.cancel();
+    registerCv_.notify_all();
+    if (registrar_.joinable()) {
+        registrar_.join();
+    }
+    if (reader_.joinable()) {
+        reader_.join();
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    if (wakeFd_ >= 0) {
+        close(wakeFd_);
+        wakeFd_ = -1;
+    }
+}
+
+size_t DirWatcher::watchCount() const {
+    lock_guard<mutex> lock(watchMutex_);
+    return paths_.size();
+}
+
+void DirWatcher::addWatch(const fs::path& dir) {
+    int wd = inotify_add_watch(fd_, dir.c_str(), kWatchMask);
+    if (wd < 0) {
+        // Typically ENOSPC: fs.inotify.max_user_watches reached
+        ++failedWatches_;
+        return;
+    }
+    lock_guard<mutex> lock(watchMutex_);
+    paths_[wd] = dir.string();
+}
+
+void DirWatcher::addTree(const fs::path& dir, OpControl* ctl) {
+    addWatch(dir);
+    if (!recursive_) {
+        return;
+    }
+
+    // inotify_add_watch is one syscall per directory: on a big tree
+    // registration is dominated by it, so spread it over the walker threads
+    fsutil::WalkOptions options;
+    options.ctl = ctl;
+    fsutil::walkParallel(dir, options, [&](fsutil::WalkEntry& entry) {
+        if (ctl) ctl->addEntry();
+        if (!entry.isDirectory()) {
+            return false;
+        }
+        addWatch(entry.path());
+        return true;
+    });
+}
+
+void DirWatcher::readerLoop() {
+    // inotify_event needs this alignment
+    alignas(inotify_event) char buf[64 * 1024];
+
+    while (!stopping_.load()) {
+        pollfd pfds[2] = {{fd_, POLLIN, 0}, {wakeFd_, POLLIN, 0}};
+        int ready = poll(pfds, 2, 100);
+        if (!movedAway_.empty()) {
+            dropMovedAway();
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        if (pfds[1].revents & POLLIN) {
+            drainInjected();
+        }
+        if (!(pfds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        ssize_t len = read(fd_, buf, sizeof(buf));
+        if (len <= 0) {
+            continue;
+        }
+
+        for (char* p = buf; p < buf + len;) {
+            auto* ev = reinterpret_cast<inotify_event*>(p);
+            p += sizeof(inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                ++dropped_;
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                lock_guard<mutex> lock(watchMutex_);
+                paths_.erase(ev->wd);
+                continue;
+            }
+
+            WatchEvent event;
+            event.mask = ev->mask;
+            event.cookie = ev->cookie;
+            {
+                lock_guard<mutex> lock(watchMutex_);
+                auto it = paths_.find(ev->wd);
+                if (it == paths_.end()) {
+                    continue;
+                }
+                event.path = it->second;
+            }
+            if (ev->len > 0 && ev->name[0] != '\0') {
+                event.path = (fs::path(event.path) / ev->name).string();
+            }
+
+            if (recursive_ && (ev->mask & IN_ISDIR) && (ev->mask & IN_MOVED_FROM)) {
+                MovedAway moved{event.path, {}, chrono::steady_clock::now()};
+                string prefix = event.path + "/";
+                lock_guard<mutex> lock(watchMutex_);
+                for (const auto& [wd, path] : paths_) {
+                    if (path == event.path || path.compare(0, prefix.size(), prefix) == 0) {
+                        moved.wds.push_back(wd);
+                    }
+                }
+                movedAway_[ev->cookie] = move(moved);
+            } else if (ev->mask & IN_MOVED_TO) {
+                // Moved within the tree: the registrar re-adds the watches,
+                // which renames their paths_ entries
+                movedAway_.erase(ev->cookie);
+            }
+
+            bool newDir = recursive_ && (ev->mask & IN_ISDIR) &&
+                          (ev->mask & (IN_CREATE | IN_MOVED_TO));
+            if (newDir) {
+                // Walking a big moved-in tree here would stop the draining
+                // and overflow the kernel queue
+                lock_guard<mutex> lock(registerMutex_);
+                newDirs_.push_back(NewDir{event.path, (ev->mask & IN_CREATE) != 0});
+                registerCv_.notify_one();
+            }
+
+            if (!ring_.push(event)) {
+                ++dropped_;
+            }
+        }
+    }
+}
+
+void DirWatcher::dropMovedAway() {
+    auto now = chrono::steady_clock::now();
+    for (auto it = movedAway_.begin(); it != movedAway_.end();) {
+        if (now - it->second.at < kMoveGrace) {
+            ++it;
+            continue;
+        }
+        // Otherwise its events would keep arriving under the old path. A
+        // watch the registrar re-added elsewhere meanwhile has a new path
+        // and is kept.
+        const MovedAway& moved = it->second;
+        string prefix = moved.from + "/";
+        {
+            lock_guard<mutex> lock(watchMutex_);
+            for (int wd : moved.wds) {
+                auto path = paths_.find(wd);
+                if (path != paths_.end() &&
+                    (path->second == moved.from ||
+                     path->second.compare(0, prefix.size(), prefix) == 0)) {
+                    inotify_rm_watch(fd_, wd);
+                    paths_.erase(path);
+                }
+            }
+        }
+        it = movedAway_.erase(it);
+    }
+}
+
+void DirWatcher::drainInjected() {
+    // Reset the eventfd counter; its value does not matter
+    uint64_t count;
+    ssize_t n = read(wakeFd_, &count, sizeof(count));
+    (void)n;
+    vector<WatchEvent> events;
+    {
+        lock_guard<mutex> lock(registerMutex_);
+        events.swap(injected_);
+    }
+    for (auto& event : events) {
+        if (!ring_.push(event)) {
+            ++dropped_;
+        }
+    }
+}
+
+void DirWatcher::registrarLoop() {
+    for (;;) {
+        NewDir dir;
+        {
+            unique_lock<mutex> lock(registerMutex_);
+            registerCv_.wait(lock, [&] { return stopping_.load() || !newDirs_.empty(); });
+            if (stopping_.load()) {
+                return;
+            }
+            dir = move(newDirs_.front());
+            newDirs_.pop_front();
+        }
+
+        try {
+            addTree(dir.path, &registrarCtl_);
+        } catch (const OperationCancelled&) {
+            return;
+        } catch (const exception&) {
+            // Removed again before it could be walked
+            continue;
+        }
+        if (!dir.reportContents) {
+            // A moved-in tree is reported by its single move line
+            continue;
+        }
+
+        // Anything created in a new directory before its watch existed was
+        // not reported by the kernel; report what is there now
+        vector<WatchEvent> events;
+        error_code ec;
+        for (fs::recursive_directory_iterator it(dir.path, ec), end;
+             !ec && it != end; it.increment(ec)) {
+            WatchEvent synthetic;
+            synthetic.mask = IN_CREATE | (it->is_directory(ec) ? IN_ISDIR : 0);
+            synthetic.path = it->path().string();
+            events.push_back(move(synthetic));
+        }
+        if (events.empty()) {
+            continue;
+        }
+        {
+            lock_guard<mutex> lock(registerMutex_);
+            for (auto& event : events) {
+                injected_.push_back(move(event));
+            }
+        }
+        uint64_t one = 1;
+        ssize_t n = write(wakeFd_, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+void WatchCoalescer::add(const WatchEvent& event, Clock::time_point now) {
+    uint32_t mask = event.mask;
+
+    if (mask & IN_MOVED_FROM) {
+        // Report what happened to the file before it moved, first
+        // The slot becomes a tombstone: erasing it here would shift every
+        // later slot, making a burst of renames quadratic
+        auto it = index_.find(event.path);
+        if (it != index_.end()) {
+            Pending& p = pending_[it->second];
+            ready_.push_back(describe(p));
+            p.erased = true;
+            ++tombstones_;
+            index_.erase(it);
+        }
+        moves_[event.cookie] = PendingMove{event.path, now};
+        return;
+    }
+    if (mask & IN_MOVED_TO) {
+        auto it = moves_.find(event.cookie);
+        if (it != moves_.end()) {
+            ready_.push_back("MOVED     " + it->second.from + " -> " + event.path);
+            moves_.erase(it);
+        } else {
+            ready_.push_back("MOVED IN  " + event.path);
+        }
+        return;
+    }
+    if (mask & IN_DELETE_SELF) {
+        // The parent's IN_DELETE already reports this, except for the root
+        return;
+    }
+
+    auto it = index_.find(event.path);
+    if (it == index_.end()) {
+        it = index_.emplace(event.path, pending_.size()).first;
+        pending_.push_back(Pending{});
+        pending_.back().path = event.path;
+        pending_.back().first = now;
+    }
+    Pending& p = pending_[it->second];
+    p.isDir = p.isDir || (mask & IN_ISDIR);
+    if (mask & IN_CREATE) p.created = true;
+    if (mask & IN_DELETE) p.deleted = true;
+    if (mask & IN_MODIFY) ++p.modified;
+    if (mask & IN_ATTRIB) p.attrib = true;
+}
+
+vector<string> WatchCoalescer::flush(Clock::time_point now, bool force) {
+    vector<string> lines;
+    lines.swap(ready_);
+
+    for (auto it = moves_.begin(); it != moves_.end();) {
+        if (force || now - it->second.at >= window_) {
+            lines.push_back("MOVED OUT " + it->second.from);
+            it = moves_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // pending_ is ordered by first event, so the due ones form a prefix
+    size_t due = 0;
+    while (due < pending_.size() && (force || now - pending_[due].first >= window_)) {
+        if (!pending_[due].erased) {
+            lines.push_back(describe(pending_[due]));
+        }
+        ++due;
+    }
+
+    // Compact once: drop the due prefix and any tombstones behind it
+    if (due > 0 || tombstones_ > 0) {
+        size_t kept = 0;
+        for (size_t i = due; i < pending_.size(); ++i) {
+            if (!pending_[i].erased) {
+                if (kept != i) {
+                    pending_[kept] = move(pending_[i]);
+                }
+                ++kept;
+            }
+        }
+        pending_.resize(kept);
+        tombstones_ = 0;
+        reindex();
+    }
+    return lines;
+}
+
+string WatchCoalescer::describe(const Pending& p) {
+    string path = p.path + (p.isDir ? "/" : "");
+    if (p.created && p.deleted) {
+        return "TRANSIENT " + path;  // Created and removed within the window
+    }
+    if (p.created) {
+        return "CREATED   " + path;
+    }
+    if (p.deleted) {
+        return "DELETED   " + path;
+    }
+    if (p.modified > 0) {
+        string line = "MODIFIED  " + path;
+        if (p.modified > 1) line += " (x" + to_string(p.modified) + ")";
+        return line;
+    }
+    return "ATTRIB    " + path;
+}
+
+void WatchCoalescer::reindex() {
+    index_.clear();
+    for (size_t i = 0; i < pending_.size(); ++i) {
+        index_[pending_[i].path] = i;
+    }
+}
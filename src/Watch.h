@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "OpControl.h"
+#include "SpscRing.h"
+
+using namespace std;
+
+// One inotify event with the watched directory already resolved
+struct WatchEvent {
+    uint32_t mask{0};
+    uint32_t cookie{0};  // Pairs IN_MOVED_FROM with IN_MOVED_TO
+    string path;
+};
+
+// inotify watches over a directory (optionally its whole subtree). A
+// dedicated reader thread drains the inotify fd as fast as possible into a
+// lock-free ring so bursts are not lost while the consumer is printing.
+// Directories created or moved in are handed to a second thread, which adds
+// watches for their subtree without holding up the reader.
+class DirWatcher {
+public:
+    DirWatcher(const filesystem::path& root, bool recursive, size_t ringCapacity = 65536);
+    ~DirWatcher();
+
+    DirWatcher(const DirWatcher&) = delete;
+    DirWatcher& operator=(const DirWatcher&) = delete;
+
+    // Register the watches (in parallel for a recursive tree) and start the
+    // reader thread. Throws runtime_error if inotify is unavailable.
+    void start(OpControl* ctl);
+    void stop();
+
+    // Consumer side of the ring
+    bool pop(WatchEvent& event) { return ring_.pop(event); }
+
+    size_t watchCount() const;
+    uint64_t failedWatches() const { return failedWatches_.load(); }
+    // Events lost because the ring or the kernel queue overflowed
+    uint64_t droppedEvents() const { return dropped_.load(); }
+
+private:
+    void addWatch(const filesystem::path& dir);
+    void addTree(const filesystem::path& dir, OpControl* ctl);
+    void readerLoop();
+    void registrarLoop();
+    void drainInjected();
+    void dropMovedAway();
+
+    struct NewDir {
+        filesystem::path path;
+        bool reportContents{false};  // Created rather than moved in
+    };
+    // A watched directory seen in IN_MOVED_FROM. If no IN_MOVED_TO with the
+    // same cookie follows, it left the tree and its watches are removed.
+    struct MovedAway {
+        string from;
+        vector<int> wds;  // The directory and everything watched below it
+        chrono::steady_clock::time_point at;
+    };
+
+    filesystem::path root_;
+    bool recursive_;
+    int fd_{-1};
+
+    mutable mutex watchMutex_;
+    unordered_map<int, string> paths_;  // wd -> directory
+    unordered_map<uint32_t, MovedAway> movedAway_;  // Reader only, by cookie
+
+    SpscRing<WatchEvent> ring_;
+    int wakeFd_{-1};  // eventfd: injected_ has events for the reader
+
+    // Reader -> registrar: subtrees to watch. Registrar -> reader: events
+    // it synthesised, which only the reader may push (the ring is SPSC).
+    mutex registerMutex_;
+    condition_variable registerCv_;
+    deque<NewDir> newDirs_;
+    vector<WatchEvent> injected_;
+    OpControl registrarCtl_;  // Cancelled by stop() to cut a big walk short
+
+    atomic<bool> stopping_{false};
+    atomic<uint64_t> failedWatches_{0};
+    atomic<uint64_t> dropped_{0};
+    thread reader_;
+    thread registrar_;
+};
+
+// Merges the raw events of each path seen within `window` into one line
+// (e.g. a create followed by many writes prints once as CREATED) and pairs
+// renames by cookie. Single-threaded: used on the consumer side.
+class WatchCoalescer {
+public:
+    using Clock = chrono::steady_clock;
+
+    explicit WatchCoalescer(chrono::milliseconds window) : window_(window) {}
+
+    void add(const WatchEvent& event, Clock::time_point now);
+
+    // Lines for changes whose window has passed (everything if force)
+    vector<string> flush(Clock::time_point now, bool force);
+
+private:
+    struct Pending {
+        string path;
+        Clock::time_point first;
+        bool isDir{false};
+        bool created{false};
+        bool deleted{false};
+        bool attrib{false};
+        unsigned modified{0};
+        bool erased{false};  // Moved away; dropped at the next flush
+    };
+    struct PendingMove {
+        string from;
+        Clock::time_point at;
+    };
+
+    static string describe(const Pending& p);
+    void reindex();
+
+    chrono::milliseconds window_;
+    vector<Pending> pending_;                 // In order of first event
+    size_t tombstones_{0};                    // Erased slots in pending_
+    unordered_map<string, size_t> index_;     // path -> slot in pending_
+    unordered_map<uint32_t, PendingMove> moves_;
+    vector<string> ready_;                    // Lines that need no waiting
+};
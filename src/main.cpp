@@ -1,8 +1,12 @@
 #include<iostream>
 #include<filesystem>
 
+#include<string>
+#include<vector>
+
 #include"App.h"
 #include"Commands.h"
+#include"Daemon.h"
 #include"FileSystemContext.h"
 
 using namespace std;
@@ -10,19 +14,47 @@ using namespace std;
 int main(int argc,char* argv[]){
     namespace fs=filesystem;
 
+    // MiniFileExplorer [dir]
+    // MiniFileExplorer --daemon [--socket PATH] [dir]
+    // MiniFileExplorer --client [--socket PATH] [command...]
+    bool daemonMode=false;
+    bool clientMode=false;
+    fs::path socketPath=defaultSocketPath();
+    vector<string> rest;
+    for(int i=1;i<argc;++i){
+        string arg=argv[i];
+        if(rest.empty()&&arg=="--daemon"){
+            daemonMode=true;
+        }else if(rest.empty()&&arg=="--client"){
+            clientMode=true;
+        }else if(rest.empty()&&arg=="--socket"&&i+1<argc){
+            socketPath=argv[++i];
+        }else{
+            rest.push_back(arg);
+        }
+    }
+
+    if(clientMode){
+        string command;
+        for(const auto& part:rest){
+            command+=(command.empty()?"":" ")+part;
+        }
+        return runClient(socketPath,command);
+    }
+
     FileSystemContext ctx;
 
     try{
-        if(argc>1){
-            fs::path specifiedDir = fs::weakly_canonical(argv[1]);
+        if(!rest.empty()){
+            fs::path specifiedDir = fs::weakly_canonical(rest[0]);
             // Check if the specified directory exists
             if(!fs::exists(specifiedDir)){
-                cerr<<"Directory not found: "<<argv[1]<<endl;
+                cerr<<"Directory not found: "<<rest[0]<<endl;
                 return 1;
             }
             // Check if it's actually a directory (not a file)
             if(!fs::is_directory(specifiedDir)){
-                cerr<<"Not a directory: "<<argv[1]<<endl;
+                cerr<<"Not a directory: "<<rest[0]<<endl;
                 return 1;
             }
             ctx.currentDir = specifiedDir;
@@ -35,10 +67,24 @@ int main(int argc,char* argv[]){
     }
 
     ctx.homeDir=getenv("HOME");
+    if(const char* tmp=getenv("TMPDIR")){
+        ctx.sortTempDir=tmp;
+    }
+    ctx.dirCache=make_shared<DirCache>();
+    ctx.pathCache=make_shared<PathCache>();
+    ctx.op=make_shared<OpControl>();
+    ctx.jobs=make_shared<JobTable>();
 
     CommandRegistry registry;
     registerBuiltInCommands(registry);
 
+    if(daemonMode){
+        // Sessions get their own op and job table; the caches are shared
+        ctx.jobs=nullptr;
+        Daemon daemon(socketPath,registry,ctx);
+        return daemon.run();
+    }
+
     cout<<"Welcome to MiniFileExplorer!\n";
 
     App app(ctx,registry);
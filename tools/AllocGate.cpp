@@ -0,0 +1,168 @@
+// allocgate: benchmark gate for heap allocations per listed entry. Builds a
+// scratch tree, runs the listing paths behind ls, ls -t and search, and
+// fails if any of them allocates more per entry than the checked-in
+// baseline allows. Built with -DMINIFILEEXPLORER_ALLOC_STATS=ON; run through
+// the alloc_gate target:
+//
+//   cmake --build build --target alloc_gate
+//   ./build/allocgate --update tools/alloc_baseline.txt   # accept new numbers
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+#include "../src/AllocStats.h"
+#include "../src/ExternalSort.h"
+#include "../src/FsUtil.h"
+
+using namespace std;
+namespace fs = filesystem;
+
+namespace {
+
+constexpr int kFiles = 5000;
+constexpr int kSubdirs = 20;
+constexpr int kFilesPerSubdir = 100;
+constexpr int kRepeats = 3;
+// Allowed growth over the baseline before the gate fails
+constexpr double kTolerance = 0.05;
+
+struct Metric {
+    string name;
+    function<uint64_t()> run;  // Returns the number of entries listed
+};
+
+// Fewest allocations per entry over a few runs, after one warm-up run
+double allocationsPerEntry(const Metric& metric) {
+    metric.run();
+    double best = -1;
+    for (int i = 0; i < kRepeats; ++i) {
+        uint64_t before = allocCounters().allocations;
+        uint64_t entries = metric.run();
+        uint64_t allocations = allocCounters().allocations - before;
+        double perEntry = static_cast<double>(allocations) / static_cast<double>(max<uint64_t>(1, entries));
+        best = best < 0 ? perEntry : min(best, perEntry);
+    }
+    return best;
+}
+
+void buildTree(const fs::path& root) {
+    fs::create_directories(root / "flat");
+    for (int i = 0; i < kFiles; ++i) {
+        ofstream(root / "flat" / ("file_" + to_string(i) + ".txt")) << i;
+    }
+    for (int d = 0; d < kSubdirs; ++d) {
+        fs::path sub = root / "tree" / ("dir_" + to_string(d));
+        fs::create_directories(sub);
+        for (int i = 0; i < kFilesPerSubdir; ++i) {
+            ofstream(sub / ("file_" + to_string(i) + ".txt")) << i;
+        }
+    }
+}
+
+map<string, double> readBaseline(const string& path) {
+    map<string, double> baseline;
+    ifstream in(path);
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream fields(line);
+        string name;
+        double value;
+        if (fields >> name >> value) {
+            baseline[name] = value;
+        }
+    }
+    return baseline;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bool update = false;
+    string baselinePath;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--update") {
+            update = true;
+        } else {
+            baselinePath = arg;
+        }
+    }
+    if (baselinePath.empty()) {
+        cerr << "Usage: allocgate [--update] <baseline file>\n";
+        return 2;
+    }
+    if (!allocStatsEnabled()) {
+        cerr << "allocgate: built without MINIFILEEXPLORER_ALLOC_STATS\n";
+        return 2;
+    }
+
+    const char* tmp = getenv("TMPDIR");
+    string pattern = string(tmp ? tmp : "/tmp") + "/allocgate-XXXXXX";
+    if (!mkdtemp(&pattern[0])) {
+        cerr << "allocgate: cannot create a scratch directory\n";
+        return 2;
+    }
+    fs::path root = pattern;
+    buildTree(root);
+
+    vector<Metric> metrics = {
+        {"list", [&] { return static_cast<uint64_t>(fsutil::listDirectory(root / "flat").size()); }},
+        {"list-sorted", [&] {
+             // ls -t: streamed into the external sorter, then emitted
+             ExternalSorter sorter(256 * 1024 * 1024, root);
+             fsutil::listDirectory(root / "flat", nullptr, [&](const FileInfo& info) {
+                 sorter.add(sortKeyNewestFirst(info.mtime), info);
+             });
+             uint64_t emitted = 0;
+             sorter.finish([&](const FileInfo&) { ++emitted; });
+             return emitted;
+         }},
+        {"search", [&] { return static_cast<uint64_t>(fsutil::searchRecursive(root / "tree", "file").size()); }},
+    };
+
+    map<string, double> baseline = readBaseline(baselinePath);
+    map<string, double> measured;
+    bool failed = false;
+    for (const auto& metric : metrics) {
+        double value = allocationsPerEntry(metric);
+        measured[metric.name] = value;
+
+        cout << left << setw(14) << metric.name << right << fixed << setprecision(2)
+             << setw(10) << value << " allocs/entry";
+        auto it = baseline.find(metric.name);
+        if (update) {
+            cout << "\n";
+        } else if (it == baseline.end()) {
+            cout << "  (no baseline)\n";
+        } else if (value > it->second * (1 + kTolerance)) {
+            cout << "  REGRESSION (baseline " << it->second << ")\n";
+            failed = true;
+        } else {
+            cout << "  ok (baseline " << it->second << ")\n";
+        }
+    }
+
+    error_code ec;
+    fs::remove_all(root, ec);
+
+    if (update) {
+        ofstream out(baselinePath);
+        out << "# Heap allocations per listed entry, checked by the alloc_gate target.\n"
+               "# Regenerate with: allocgate --update tools/alloc_baseline.txt\n";
+        for (const auto& [name, value] : measured) {
+            out << name << " " << fixed << setprecision(2) << value << "\n";
+        }
+        cout << "Baseline written to " << baselinePath << "\n";
+        return 0;
+    }
+    return failed ? 1 : 0;
+}
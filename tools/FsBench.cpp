@@ -0,0 +1,95 @@
+// fsbench: times the filesystem primitives behind ls, search, find, du and
+// copy, without the interactive shell. Meant to be run under libslowfs to
+// see how each code path behaves on high-latency storage:
+//
+//   LD_PRELOAD=./libslowfs.so SLOWFS_LATENCY_US=500 ./fsbench -r 3 du /data
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/FindExpr.h"
+#include "../src/FsUtil.h"
+
+using namespace std;
+namespace fs = filesystem;
+
+namespace {
+
+void usage() {
+    cerr << "Usage: fsbench [-r N] <op> [args]\n"
+            "  list DIR         fsutil::listDirectory\n"
+            "  search DIR WORD  fsutil::searchRecursive\n"
+            "  find DIR EXPR..  fsutil::findRecursive\n"
+            "  du DIR           fsutil::calcDiskUsage\n"
+            "  copy SRC DST     fsutil::copyFile (DST is overwritten)\n";
+}
+
+// One run of the operation; returns the number of entries (or bytes) seen
+uintmax_t runOnce(const string& op, const vector<string>& args) {
+    if (op == "list" && args.size() == 1) {
+        return fsutil::listDirectory(args[0]).size();
+    }
+    if (op == "search" && args.size() == 2) {
+        return fsutil::searchRecursive(args[0], args[1]).size();
+    }
+    if (op == "find" && args.size() >= 1) {
+        vector<string> tokens(args.begin() + 1, args.end());
+        return fsutil::findRecursive(args[0], FindQuery::parse(tokens)).size();
+    }
+    if (op == "du" && args.size() == 1) {
+        fsutil::DiskUsage usage = fsutil::calcDiskUsage(args[0]);
+        return usage.files + usage.dirs;
+    }
+    if (op == "copy" && args.size() == 2) {
+        fsutil::copyFile(args[0], args[1], true);
+        return fs::file_size(args[1]);
+    }
+    usage();
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int repeat = 1;
+    vector<string> rest;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-r" && i + 1 < argc) {
+            repeat = max(1, atoi(argv[++i]));
+        } else {
+            rest.push_back(arg);
+        }
+    }
+    if (rest.empty()) {
+        usage();
+        return 2;
+    }
+    string op = rest[0];
+    vector<string> args(rest.begin() + 1, rest.end());
+
+    vector<double> times;
+    try {
+        for (int i = 0; i < repeat; ++i) {
+            auto start = chrono::steady_clock::now();
+            uintmax_t seen = runOnce(op, args);
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            times.push_back(ms);
+            cout << op << " run " << (i + 1) << ": " << seen << " in " << ms << " ms\n";
+        }
+    } catch (const exception& e) {
+        cerr << "fsbench: " << e.what() << "\n";
+        return 1;
+    }
+
+    sort(times.begin(), times.end());
+    cout << op << " min " << times.front() << " ms, median " << times[times.size() / 2]
+         << " ms\n";
+    return 0;
+}
@@ -0,0 +1,131 @@
+// regcheck: scripted regression checks for behaviour that is awkward to see
+// from the shell. Each check builds its own scratch files, runs the module
+// directly and prints ok or FAIL. Built with -DMINIFILEEXPLORER_BUILD_TOOLS=ON;
+// run through the check_regressions target:
+//
+//   cmake --build build --target check_regressions
+
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../src/FindExpr.h"
+#include "../src/Sync.h"
+
+using namespace std;
+namespace fs = filesystem;
+
+namespace {
+
+struct Check {
+    string name;
+    function<string(const fs::path&)> run;  // Returns an empty string on success
+};
+
+void writeZeros(const fs::path& path, uintmax_t size) {
+    ofstream out(path, ios::binary);
+    vector<char> zeros(64 * 1024, 0);
+    for (uintmax_t left = size; left > 0;) {
+        size_t n = static_cast<size_t>(min<uintmax_t>(left, zeros.size()));
+        out.write(zeros.data(), static_cast<streamsize>(n));
+        left -= n;
+    }
+}
+
+// One changed byte in a zero-filled file must rewrite one block, not every
+// block after it: in place, only same-offset blocks may count as reused
+string syncPatchesOneBlock(const fs::path& root) {
+    constexpr uintmax_t kSize = 16 * 1024 * 1024;
+    constexpr uintmax_t kChangedAt = 70005;
+    fs::create_directories(root / "src");
+    writeZeros(root / "src" / "zeros.bin", kSize);
+
+    SyncOptions options;
+    syncTrees(root / "src", root / "dst", options);
+    {
+        fstream file(root / "src" / "zeros.bin", ios::in | ios::out | ios::binary);
+        file.seekp(kChangedAt);
+        file.put(1);
+    }
+    SyncStats stats = syncTrees(root / "src", root / "dst", options);
+
+    if (stats.filesPatched != 1) {
+        return "expected one patched file, got " + to_string(stats.filesPatched);
+    }
+    if (stats.bytesWritten > options.blockSize || stats.bytesReused < kSize - options.blockSize) {
+        return "wrote " + to_string(stats.bytesWritten) + " bytes, reused " +
+               to_string(stats.bytesReused) + " bytes";
+    }
+    ifstream copy(root / "dst" / "zeros.bin", ios::binary);
+    copy.seekg(kChangedAt);
+    if (copy.get() != 1 || fs::file_size(root / "dst" / "zeros.bin") != kSize) {
+        return "destination does not match the source";
+    }
+    return "";
+}
+
+// Bad numbers must come back as the runtime_error the find command reports,
+// not as the out_of_range stoull throws, which would end the shell
+string findRejectsBadNumbers(const fs::path&) {
+    vector<vector<string>> inputs = {
+        {"-size", "+99999999999999999999999"},
+        {"-mtime", "-99999999999999999999999"},
+        {"-maxdepth", "99999999999999999999999"},
+        {"-size", "12x"},
+        {"-mtime", "+"},
+    };
+    for (const auto& tokens : inputs) {
+        try {
+            FindQuery::parse(tokens);
+            return "accepted " + tokens[0] + " " + tokens[1];
+        } catch (const runtime_error&) {
+            // Expected
+        } catch (const exception& e) {
+            return tokens[0] + " " + tokens[1] + " threw " + e.what();
+        }
+    }
+    return "";
+}
+
+} // namespace
+
+int main() {
+    const char* tmp = getenv("TMPDIR");
+    string pattern = string(tmp ? tmp : "/tmp") + "/regcheck-XXXXXX";
+    if (!mkdtemp(&pattern[0])) {
+        cerr << "regcheck: cannot create a scratch directory\n";
+        return 2;
+    }
+    fs::path root = pattern;
+
+    vector<Check> checks = {
+        {"sync-patch-in-place", syncPatchesOneBlock},
+        {"find-bad-numbers", findRejectsBadNumbers},
+    };
+
+    bool failed = false;
+    for (const auto& check : checks) {
+        fs::path dir = root / check.name;
+        fs::create_directories(dir);
+        string problem;
+        try {
+            problem = check.run(dir);
+        } catch (const exception& e) {
+            problem = string("threw: ") + e.what();
+        }
+        if (problem.empty()) {
+            cout << check.name << ": ok\n";
+        } else {
+            cout << check.name << ": FAIL (" << problem << ")\n";
+            failed = true;
+        }
+    }
+
+    error_code ec;
+    fs::remove_all(root, ec);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,562 @@
+// libslowfs: an LD_PRELOAD shim that makes the local disk behave like slow
+// (NFS-like) storage, so parallel and batched code paths can be compared
+// against a high-latency filesystem on any Linux box.
+//
+//   LD_PRELOAD=./libslowfs.so SLOWFS_STAT_US=1500 SLOWFS_ROOT=/data ./fsbench du /data
+//
+// Environment (all optional):
+//   SLOWFS_LATENCY_US   latency added to every interposed call (default 0)
+//   SLOWFS_<CLASS>_US   per-class override; classes are OPEN, CLOSE, STAT,
+//                       READDIR, READ, WRITE, UNLINK, MKDIR, RENAME
+//   SLOWFS_JITTER_US    extra uniform random latency in [0, N]
+//   SLOWFS_SEED         jitter seed, so runs are reproducible (default 1)
+//   SLOWFS_READ_BPS     read throughput cap shared by all threads, e.g. 50M
+//   SLOWFS_WRITE_BPS    write throughput cap, e.g. 20M
+//   SLOWFS_DIRENT_BATCH readdir entries per simulated round trip (default 64)
+//   SLOWFS_ROOT         only slow down paths under this directory
+//   SLOWFS_REPORT       where to print call counts at exit: a file path,
+//                       "stderr" (default) or "off"
+//
+// Path calls are slowed when the path is under SLOWFS_ROOT (or always,
+// without it); descriptor calls only for descriptors this shim opened, so
+// the terminal and pipes keep their speed. Every call is counted.
+
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+enum CallClass { Open, Close, Stat, Readdir, Read, Write, Unlink, Mkdir, Rename, kClassCount };
+
+const char* const kClassNames[kClassCount] = {
+    "OPEN", "CLOSE", "STAT", "READDIR", "READ", "WRITE", "UNLINK", "MKDIR", "RENAME",
+};
+
+constexpr int kMaxTrackedFd = 65536;
+
+struct Config {
+    uint64_t latencyNs[kClassCount]{};
+    uint64_t jitterNs{0};
+    uint64_t seed{1};
+    uint64_t readBps{0};
+    uint64_t writeBps{0};
+    uint32_t direntBatch{64};
+    string root;
+    string report{"stderr"};
+};
+
+uint64_t envNumber(const char* name, uint64_t fallback) {
+    const char* value = getenv(name);
+    if (!value || !*value) {
+        return fallback;
+    }
+    char* end = nullptr;
+    uint64_t n = strtoull(value, &end, 10);
+    switch (end ? *end : '\0') {
+        case 'k': case 'K': n <<= 10; break;
+        case 'm': case 'M': n <<= 20; break;
+        case 'g': case 'G': n <<= 30; break;
+        default: break;
+    }
+    return n;
+}
+
+Config loadConfig() {
+    Config c;
+    uint64_t base = envNumber("SLOWFS_LATENCY_US", 0);
+    for (int i = 0; i < kClassCount; ++i) {
+        string name = string("SLOWFS_") + kClassNames[i] + "_US";
+        c.latencyNs[i] = envNumber(name.c_str(), base) * 1000;
+    }
+    c.jitterNs = envNumber("SLOWFS_JITTER_US", 0) * 1000;
+    c.seed = envNumber("SLOWFS_SEED", 1);
+    c.readBps = envNumber("SLOWFS_READ_BPS", 0);
+    c.writeBps = envNumber("SLOWFS_WRITE_BPS", 0);
+    c.direntBatch = static_cast<uint32_t>(max<uint64_t>(1, envNumber("SLOWFS_DIRENT_BATCH", 64)));
+    if (const char* root = getenv("SLOWFS_ROOT")) {
+        c.root = root;
+        while (c.root.size() > 1 && c.root.back() == '/') {
+            c.root.pop_back();
+        }
+    }
+    if (const char* report = getenv("SLOWFS_REPORT")) {
+        c.report = report;
+    }
+    return c;
+}
+
+const Config& config() {
+    static const Config c = loadConfig();
+    return c;
+}
+
+struct Counters {
+    atomic<uint64_t> calls{0};
+    atomic<uint64_t> slowed{0};
+    atomic<uint64_t> delayNs{0};
+    atomic<uint64_t> bytes{0};
+};
+
+Counters counters[kClassCount];
+
+// Descriptors opened through the shim under SLOWFS_ROOT, plus a per-fd
+// readdir counter for batching
+atomic<bool> trackedFds[kMaxTrackedFd];
+atomic<uint32_t> direntCounts[kMaxTrackedFd];
+
+void setTracked(int fd, bool tracked) {
+    if (fd >= 0 && fd < kMaxTrackedFd) {
+        trackedFds[fd].store(tracked, memory_order_relaxed);
+        direntCounts[fd].store(0, memory_order_relaxed);
+    }
+}
+
+bool isTracked(int fd) {
+    return fd >= 0 && fd < kMaxTrackedFd && trackedFds[fd].load(memory_order_relaxed);
+}
+
+uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+void sleepNs(uint64_t ns) {
+    timespec ts{static_cast<time_t>(ns / 1000000000ull), static_cast<long>(ns % 1000000000ull)};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+uint64_t jitter() {
+    uint64_t range = config().jitterNs;
+    if (range == 0) {
+        return 0;
+    }
+    // xorshift per thread; threads get distinct but reproducible streams
+    static atomic<uint64_t> threadSeq{0};
+    thread_local uint64_t state =
+        (config().seed ^ (0x9e3779b97f4a7c15ull * (threadSeq.fetch_add(1) + 1))) | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state % (range + 1);
+}
+
+// Count the call and, if it touches slow storage, wait out its latency
+void charge(CallClass cls, bool slow) {
+    Counters& c = counters[cls];
+    c.calls.fetch_add(1, memory_order_relaxed);
+    if (!slow) {
+        return;
+    }
+    uint64_t delay = config().latencyNs[cls] + jitter();
+    c.slowed.fetch_add(1, memory_order_relaxed);
+    if (delay > 0) {
+        c.delayNs.fetch_add(delay, memory_order_relaxed);
+        sleepNs(delay);
+    }
+}
+
+// Throughput cap: a shared link that transfers one request at a time, so
+// concurrent readers split the bandwidth instead of each getting all of it
+class Link {
+public:
+    void transfer(uint64_t bytes, uint64_t bytesPerSecond, Counters& c) {
+        c.bytes.fetch_add(bytes, memory_order_relaxed);
+        if (bytesPerSecond == 0 || bytes == 0) {
+            return;
+        }
+        uint64_t cost = bytes * 1000000000ull / bytesPerSecond;
+        uint64_t done;
+        {
+            lock_guard<mutex> lock(mutex_);
+            uint64_t now = nowNs();
+            uint64_t start = max(now, nextFreeNs_);
+            nextFreeNs_ = start + cost;
+            done = nextFreeNs_;
+        }
+        uint64_t now = nowNs();
+        if (done > now) {
+            c.delayNs.fetch_add(done - now, memory_order_relaxed);
+            sleepNs(done - now);
+        }
+    }
+
+private:
+    mutex mutex_;
+    uint64_t nextFreeNs_{0};
+};
+
+Link readLink;
+Link writeLink;
+
+bool underRoot(const char* path) {
+    const string& root = config().root;
+    if (root.empty()) {
+        return true;
+    }
+    if (!path) {
+        return false;
+    }
+    string full;
+    if (path[0] == '/') {
+        full = path;
+    } else {
+        char cwd[4096];
+        if (!getcwd(cwd, sizeof(cwd))) {
+            return false;
+        }
+        full = string(cwd) + "/" + path;
+    }
+    return full.compare(0, root.size(), root) == 0 &&
+           (full.size() == root.size() || full[root.size()] == '/' || root == "/");
+}
+
+// A *at() call is slow if its directory fd is, or its path is absolute
+// (or cwd-relative) and under the root
+bool slowAt(int dirfd, const char* path) {
+    if (path && path[0] != '/' && dirfd != AT_FDCWD) {
+        return isTracked(dirfd);
+    }
+    return underRoot(path);
+}
+
+template <typename Fn>
+Fn real(const char* name) {
+    return reinterpret_cast<Fn>(dlsym(RTLD_NEXT, name));
+}
+
+#define REAL(name) static const auto real_##name = real<decltype(&::name)>(#name)
+
+void writeReport() {
+    const Config& c = config();
+    if (c.report == "off") {
+        return;
+    }
+    FILE* out = (c.report == "stderr") ? stderr : fopen(c.report.c_str(), "a");
+    if (!out) {
+        return;
+    }
+    fprintf(out, "slowfs: %-8s %12s %12s %12s %14s\n", "class", "calls", "slowed",
+            "delay(ms)", "bytes");
+    for (int i = 0; i < kClassCount; ++i) {
+        const Counters& k = counters[i];
+        if (k.calls.load() == 0) {
+            continue;
+        }
+        fprintf(out, "slowfs: %-8s %12llu %12llu %12.1f %14llu\n", kClassNames[i],
+                static_cast<unsigned long long>(k.calls.load()),
+                static_cast<unsigned long long>(k.slowed.load()),
+                static_cast<double>(k.delayNs.load()) / 1e6,
+                static_cast<unsigned long long>(k.bytes.load()));
+    }
+    if (out != stderr) {
+        fclose(out);
+    }
+}
+
+__attribute__((constructor)) void slowfsInit() {
+    config();
+}
+
+__attribute__((destructor)) void slowfsFini() {
+    writeReport();
+}
+
+int openMode(int flags, va_list args) {
+    return (flags & (O_CREAT | O_TMPFILE)) ? va_arg(args, int) : 0;
+}
+
+} // namespace
+
+extern "C" {
+
+// ---- Open / close ----
+
+int open(const char* path, int flags, ...) {
+    REAL(open);
+    va_list args;
+    va_start(args, flags);
+    int mode = openMode(flags, args);
+    va_end(args);
+    bool slow = underRoot(path);
+    charge(Open, slow);
+    int fd = real_open(path, flags, mode);
+    setTracked(fd, slow);
+    return fd;
+}
+
+int open64(const char* path, int flags, ...) {
+    REAL(open64);
+    va_list args;
+    va_start(args, flags);
+    int mode = openMode(flags, args);
+    va_end(args);
+    bool slow = underRoot(path);
+    charge(Open, slow);
+    int fd = real_open64(path, flags, mode);
+    setTracked(fd, slow);
+    return fd;
+}
+
+int openat(int dirfd, const char* path, int flags, ...) {
+    REAL(openat);
+    va_list args;
+    va_start(args, flags);
+    int mode = openMode(flags, args);
+    va_end(args);
+    bool slow = slowAt(dirfd, path);
+    charge(Open, slow);
+    int fd = real_openat(dirfd, path, flags, mode);
+    setTracked(fd, slow);
+    return fd;
+}
+
+int openat64(int dirfd, const char* path, int flags, ...) {
+    REAL(openat64);
+    va_list args;
+    va_start(args, flags);
+    int mode = openMode(flags, args);
+    va_end(args);
+    bool slow = slowAt(dirfd, path);
+    charge(Open, slow);
+    int fd = real_openat64(dirfd, path, flags, mode);
+    setTracked(fd, slow);
+    return fd;
+}
+
+int close(int fd) {
+    REAL(close);
+    charge(Close, isTracked(fd));
+    setTracked(fd, false);
+    return real_close(fd);
+}
+
+// ---- Metadata ----
+
+int stat(const char* path, struct stat* st) {
+    REAL(stat);
+    charge(Stat, underRoot(path));
+    return real_stat(path, st);
+}
+
+int lstat(const char* path, struct stat* st) {
+    REAL(lstat);
+    charge(Stat, underRoot(path));
+    return real_lstat(path, st);
+}
+
+int fstat(int fd, struct stat* st) {
+    REAL(fstat);
+    charge(Stat, isTracked(fd));
+    return real_fstat(fd, st);
+}
+
+int fstatat(int dirfd, const char* path, struct stat* st, int flags) {
+    REAL(fstatat);
+    charge(Stat, slowAt(dirfd, path));
+    return real_fstatat(dirfd, path, st, flags);
+}
+
+int statx(int dirfd, const char* path, int flags, unsigned int mask, struct statx* st) {
+    REAL(statx);
+    charge(Stat, slowAt(dirfd, path));
+    return real_statx(dirfd, path, flags, mask, st);
+}
+
+ssize_t readlink(const char* path, char* buf, size_t size) {
+    REAL(readlink);
+    charge(Stat, underRoot(path));
+    return real_readlink(path, buf, size);
+}
+
+int access(const char* path, int mode) {
+    REAL(access);
+    charge(Stat, underRoot(path));
+    return real_access(path, mode);
+}
+
+// ---- Directories ----
+
+DIR* opendir(const char* path) {
+    REAL(opendir);
+    bool slow = underRoot(path);
+    charge(Open, slow);
+    DIR* dir = real_opendir(path);
+    if (dir) {
+        setTracked(dirfd(dir), slow);
+    }
+    return dir;
+}
+
+DIR* fdopendir(int fd) {
+    REAL(fdopendir);
+    return real_fdopendir(fd);  // Already charged and tracked by openat()
+}
+
+int closedir(DIR* dir) {
+    REAL(closedir);
+    // closedir(nullptr) is undefined (the parameter is declared nonnull)
+    int fd = dirfd(dir);
+    charge(Close, isTracked(fd));
+    setTracked(fd, false);
+    return real_closedir(dir);
+}
+
+// One simulated round trip per SLOWFS_DIRENT_BATCH entries, like getdents
+static bool direntRoundTrip(DIR* dir) {
+    int fd = dir ? dirfd(dir) : -1;
+    if (!isTracked(fd)) {
+        return false;
+    }
+    return direntCounts[fd].fetch_add(1, memory_order_relaxed) % config().direntBatch == 0;
+}
+
+struct dirent* readdir(DIR* dir) {
+    REAL(readdir);
+    charge(Readdir, direntRoundTrip(dir));
+    return real_readdir(dir);
+}
+
+struct dirent64* readdir64(DIR* dir) {
+    REAL(readdir64);
+    charge(Readdir, direntRoundTrip(dir));
+    return real_readdir64(dir);
+}
+
+// ---- Data ----
+
+ssize_t read(int fd, void* buf, size_t count) {
+    REAL(read);
+    bool slow = isTracked(fd);
+    charge(Read, slow);
+    ssize_t n = real_read(fd, buf, count);
+    if (slow && n > 0) readLink.transfer(static_cast<uint64_t>(n), config().readBps, counters[Read]);
+    return n;
+}
+
+ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+    REAL(pread);
+    bool slow = isTracked(fd);
+    charge(Read, slow);
+    ssize_t n = real_pread(fd, buf, count, offset);
+    if (slow && n > 0) readLink.transfer(static_cast<uint64_t>(n), config().readBps, counters[Read]);
+    return n;
+}
+
+ssize_t pread64(int fd, void* buf, size_t count, off64_t offset) {
+    REAL(pread64);
+    bool slow = isTracked(fd);
+    charge(Read, slow);
+    ssize_t n = real_pread64(fd, buf, count, offset);
+    if (slow && n > 0) readLink.transfer(static_cast<uint64_t>(n), config().readBps, counters[Read]);
+    return n;
+}
+
+ssize_t write(int fd, const void* buf, size_t count) {
+    REAL(write);
+    bool slow = isTracked(fd);
+    charge(Write, slow);
+    ssize_t n = real_write(fd, buf, count);
+    if (slow && n > 0) writeLink.transfer(static_cast<uint64_t>(n), config().writeBps, counters[Write]);
+    return n;
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    REAL(pwrite);
+    bool slow = isTracked(fd);
+    charge(Write, slow);
+    ssize_t n = real_pwrite(fd, buf, count, offset);
+    if (slow && n > 0) writeLink.transfer(static_cast<uint64_t>(n), config().writeBps, counters[Write]);
+    return n;
+}
+
+ssize_t pwrite64(int fd, const void* buf, size_t count, off64_t offset) {
+    REAL(pwrite64);
+    bool slow = isTracked(fd);
+    charge(Write, slow);
+    ssize_t n = real_pwrite64(fd, buf, count, offset);
+    if (slow && n > 0) writeLink.transfer(static_cast<uint64_t>(n), config().writeBps, counters[Write]);
+    return n;
+}
+
+// In-kernel copies (used by std::filesystem::copy_file): charged as a read
+// from the source and a write to the destination
+ssize_t sendfile(int outFd, int inFd, off_t* offset, size_t count) {
+    REAL(sendfile);
+    bool slowIn = isTracked(inFd);
+    bool slowOut = isTracked(outFd);
+    charge(Read, slowIn);
+    charge(Write, slowOut);
+    ssize_t n = real_sendfile(outFd, inFd, offset, count);
+    if (n > 0) {
+        if (slowIn) readLink.transfer(static_cast<uint64_t>(n), config().readBps, counters[Read]);
+        if (slowOut) writeLink.transfer(static_cast<uint64_t>(n), config().writeBps, counters[Write]);
+    }
+    return n;
+}
+
+ssize_t copy_file_range(int inFd, off64_t* inOffset, int outFd, off64_t* outOffset,
+                        size_t count, unsigned int flags) {
+    REAL(copy_file_range);
+    bool slowIn = isTracked(inFd);
+    bool slowOut = isTracked(outFd);
+    charge(Read, slowIn);
+    charge(Write, slowOut);
+    ssize_t n = real_copy_file_range(inFd, inOffset, outFd, outOffset, count, flags);
+    if (n > 0) {
+        if (slowIn) readLink.transfer(static_cast<uint64_t>(n), config().readBps, counters[Read]);
+        if (slowOut) writeLink.transfer(static_cast<uint64_t>(n), config().writeBps, counters[Write]);
+    }
+    return n;
+}
+
+// ---- Namespace changes ----
+
+int unlink(const char* path) {
+    REAL(unlink);
+    charge(Unlink, underRoot(path));
+    return real_unlink(path);
+}
+
+int unlinkat(int dirfd, const char* path, int flags) {
+    REAL(unlinkat);
+    charge(Unlink, slowAt(dirfd, path));
+    return real_unlinkat(dirfd, path, flags);
+}
+
+int rmdir(const char* path) {
+    REAL(rmdir);
+    charge(Unlink, underRoot(path));
+    return real_rmdir(path);
+}
+
+int mkdir(const char* path, mode_t mode) {
+    REAL(mkdir);
+    charge(Mkdir, underRoot(path));
+    return real_mkdir(path, mode);
+}
+
+int rename(const char* from, const char* to) {
+    REAL(rename);
+    charge(Rename, underRoot(from) || underRoot(to));
+    return real_rename(from, to);
+}
+
+} // extern "C"